@@ -0,0 +1,435 @@
+#include <Arduino.h>
+#include "A6codec.h"
+
+// The GSM 03.38 default alphabet, as Unicode code points. 0x1B is the escape
+// to the extension table.
+static const uint16_t A6gsmAlphabet[128] = {
+    0x0040, 0x00A3, 0x0024, 0x00A5, 0x00E8, 0x00E9, 0x00F9, 0x00EC,
+    0x00F2, 0x00C7, 0x000A, 0x00D8, 0x00F8, 0x000D, 0x00C5, 0x00E5,
+    0x0394, 0x005F, 0x03A6, 0x0393, 0x039B, 0x03A9, 0x03A0, 0x03A8,
+    0x03A3, 0x0398, 0x039E, 0xFFFF, 0x00C6, 0x00E6, 0x00DF, 0x00C9,
+    0x0020, 0x0021, 0x0022, 0x0023, 0x00A4, 0x0025, 0x0026, 0x0027,
+    0x0028, 0x0029, 0x002A, 0x002B, 0x002C, 0x002D, 0x002E, 0x002F,
+    0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+    0x0038, 0x0039, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x003F,
+    0x00A1, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+    0x0048, 0x0049, 0x004A, 0x004B, 0x004C, 0x004D, 0x004E, 0x004F,
+    0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+    0x0058, 0x0059, 0x005A, 0x00C4, 0x00D6, 0x00D1, 0x00DC, 0x00A7,
+    0x00BF, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+    0x0068, 0x0069, 0x006A, 0x006B, 0x006C, 0x006D, 0x006E, 0x006F,
+    0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+    0x0078, 0x0079, 0x007A, 0x00E4, 0x00F6, 0x00F1, 0x00FC, 0x00E0,
+};
+
+// The septet for every ASCII character, so the common case is a single lookup.
+// 0xFF means it isn't in the alphabet, and 0x80 is set for the ones in the
+// extension table.
+static const byte A6asciiToGsm[128] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x0A, 0xFF, 0xFF, 0x0D, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x20, 0x21, 0x22, 0x23, 0x02, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F,
+    0x00, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F,
+    0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0xBC, 0xAF, 0xBE, 0x94, 0x11,
+    0xFF, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F,
+    0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0xA8, 0xC0, 0xA9, 0xBD, 0xFF,
+};
+
+#define A6_GSM_ESCAPE 0x1B
+#define A6_GSM_EURO 0x65
+
+
+unsigned long A6utf8Next(const char **p) {
+    const byte *s = (const byte *)*p;
+    unsigned long c = s[0];
+    byte extra;
+
+    if (c == 0) {
+        return 0;
+    } else if (c < 0x80) {
+        extra = 0;
+    } else if ((c & 0xE0) == 0xC0) {
+        c &= 0x1F;
+        extra = 1;
+    } else if ((c & 0xF0) == 0xE0) {
+        c &= 0x0F;
+        extra = 2;
+    } else if ((c & 0xF8) == 0xF0) {
+        c &= 0x07;
+        extra = 3;
+    } else {
+        *p += 1;
+        return 0xFFFD;
+    }
+
+    for (byte i = 1; i <= extra; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            // Truncated sequence, skip what we've seen of it.
+            *p += i;
+            return 0xFFFD;
+        }
+        c = (c << 6) | (s[i] & 0x3F);
+    }
+    *p += extra + 1;
+    return c;
+}
+
+
+byte A6gsmEncode(unsigned long c, byte *septets) {
+    if (c < 0x80) {
+        byte septet = A6asciiToGsm[c];
+
+        if (septet == 0xFF) {
+            return 0;
+        }
+        if (septet & 0x80) {
+            septets[0] = A6_GSM_ESCAPE;
+            septets[1] = septet & 0x7F;
+            return 2;
+        }
+        septets[0] = septet;
+        return 1;
+    }
+
+    if (c == 0x20AC) {
+        septets[0] = A6_GSM_ESCAPE;
+        septets[1] = A6_GSM_EURO;
+        return 2;
+    }
+    for (byte i = 0; i < 128; i++) {
+        if (A6gsmAlphabet[i] == c) {
+            septets[0] = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+byte A6gsmLength(unsigned long c) {
+    byte septets[2];
+    return A6gsmEncode(c, septets);
+}
+
+
+static size_t A6writeHex(Print &out, byte value) {
+    static const char digits[] = "0123456789ABCDEF";
+
+    out.write(digits[value >> 4]);
+    out.write(digits[value & 0x0F]);
+    return 2;
+}
+
+
+static size_t A6writeUnit(Print &out, unsigned int unit) {
+    return A6writeHex(out, unit >> 8) + A6writeHex(out, unit & 0xFF);
+}
+
+
+size_t A6writeUCS2(Print &out, const char *text, const char *end) {
+    size_t written = 0;
+
+    while (text < end && *text != 0) {
+        unsigned long c = A6utf8Next(&text);
+
+        if (c > 0xFFFF) {
+            // Outside the BMP, so it takes a surrogate pair.
+            c -= 0x10000;
+            written += A6writeUnit(out, 0xD800 | (c >> 10));
+            written += A6writeUnit(out, 0xDC00 | (c & 0x3FF));
+        } else {
+            written += A6writeUnit(out, c);
+        }
+    }
+    return written;
+}
+
+
+size_t A6writeUCS2(Print &out, const char *text) {
+    return A6writeUCS2(out, text, text + strlen(text));
+}
+
+
+// Put the UTF-8 encoding of c at out, returning its length.
+static byte A6utf8Put(char *out, unsigned long c) {
+    if (c < 0x80) {
+        out[0] = c;
+        return 1;
+    } else if (c < 0x800) {
+        out[0] = 0xC0 | (c >> 6);
+        out[1] = 0x80 | (c & 0x3F);
+        return 2;
+    } else if (c < 0x10000) {
+        out[0] = 0xE0 | (c >> 12);
+        out[1] = 0x80 | ((c >> 6) & 0x3F);
+        out[2] = 0x80 | (c & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (c >> 18);
+    out[1] = 0x80 | ((c >> 12) & 0x3F);
+    out[2] = 0x80 | ((c >> 6) & 0x3F);
+    out[3] = 0x80 | (c & 0x3F);
+    return 4;
+}
+
+
+// The value of every hex digit, 0xFF for everything else.
+static const byte A6hexValue[128] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// The UCS2 unit spelled by the four hex digits at p. They must be valid.
+static unsigned int A6readUnit(const char *p) {
+    return (A6hexValue[(byte)p[0]] << 12) | (A6hexValue[(byte)p[1]] << 8) | (A6hexValue[(byte)p[2]] << 4) | A6hexValue[(byte)p[3]];
+}
+
+
+bool A6decodeUCS2(char *text) {
+    size_t length = 0;
+
+    // Check it all first, so text is only changed if it's really UCS2.
+    for (const char *p = text; *p; p++, length++) {
+        if ((byte)*p >= 0x80 || A6hexValue[(byte)*p] == 0xFF) {
+            return false;
+        }
+    }
+    if (length == 0 || length % 4 != 0) {
+        return false;
+    }
+
+    // Every unit is four digits and takes at most three bytes of UTF-8 (four
+    // for a pair, which is eight digits), so the output never catches up with
+    // the input.
+    const char *in = text;
+    const char *end = text + length;
+    char *out = text;
+
+    while (in < end) {
+        unsigned long c = A6readUnit(in);
+
+        in += 4;
+        if (c >= 0xD800 && c <= 0xDBFF && in < end) {
+            unsigned int low = A6readUnit(in);
+
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                in += 4;
+            }
+        }
+        if (c >= 0xD800 && c <= 0xDFFF) {
+            // A surrogate without its other half.
+            c = 0xFFFD;
+        }
+        if (c != 0) {
+            out += A6utf8Put(out, c);
+        }
+    }
+    *out = 0;
+    return true;
+}
+
+
+void A6pduEncoder::begin(const char *number, const char *text, byte reference) {
+    const char *p = text;
+    unsigned long c;
+    int length = 0;
+
+    this->number = number;
+    this->text = text;
+    this->reference = reference;
+    part = 0;
+    partEnd = text;
+
+    // Use GSM if every character is in its alphabet, it fits more characters
+    // in a message.
+    encoding = A6_ENCODING_GSM7;
+    while ((c = A6utf8Next(&p)) != 0) {
+        if (A6gsmLength(c) == 0) {
+            encoding = A6_ENCODING_UCS2;
+            break;
+        }
+    }
+
+    // See how many parts we need.
+    parts = 1;
+    p = fillPart(text, &length);
+    if (*p != 0) {
+        // It doesn't fit in one, so the parts need a header, which leaves
+        // less room in each.
+        parts = 2;
+        p = fillPart(fillPart(text, &length), &length);
+        while (*p != 0) {
+            p = fillPart(p, &length);
+            parts++;
+        }
+    }
+}
+
+
+byte A6pduEncoder::getEncoding() {
+    return encoding;
+}
+
+
+byte A6pduEncoder::getParts() {
+    return parts;
+}
+
+
+byte A6pduEncoder::charLength(unsigned long c) {
+    if (encoding == A6_ENCODING_GSM7) {
+        return A6gsmLength(c);
+    }
+    // Characters outside the BMP need a surrogate pair.
+    return c > 0xFFFF ? 2 : 1;
+}
+
+
+// How many septets or UCS2 units fit in a part.
+int A6pduEncoder::partLimit() {
+    if (encoding == A6_ENCODING_GSM7) {
+        return parts > 1 ? 153 : 160;
+    }
+    return parts > 1 ? 67 : 70;
+}
+
+
+// Find where a part that starts at start ends, without splitting characters.
+const char *A6pduEncoder::fillPart(const char *start, int *length) {
+    const char *p = start;
+    int limit = partLimit();
+
+    *length = 0;
+    while (*p != 0) {
+        const char *next = p;
+        byte len = charLength(A6utf8Next(&next));
+
+        if (*length + len > limit) {
+            break;
+        }
+        *length += len;
+        p = next;
+    }
+    return p;
+}
+
+
+int A6pduEncoder::nextPart() {
+    int digits = 0;
+    int dataLength;
+
+    if (part >= parts) {
+        return 0;
+    }
+    partStart = partEnd;
+    partEnd = fillPart(partStart, &partLength);
+    part++;
+
+    for (const char *p = number; *p; p++) {
+        digits += *p >= '0' && *p <= '9';
+    }
+
+    if (encoding == A6_ENCODING_GSM7) {
+        dataLength = ((partLength + (parts > 1 ? 7 : 0)) * 7 + 7) / 8;
+    } else {
+        dataLength = partLength * 2 + (parts > 1 ? 6 : 0);
+    }
+
+    // First octet, message reference, address length and type, address,
+    // protocol identifier, coding scheme, data length and the data.
+    return 4 + (digits + 1) / 2 + 3 + dataLength;
+}
+
+
+size_t A6pduEncoder::write(Print &out) {
+    size_t written = 0;
+    bool concatenated = parts > 1;
+    int digits = 0;
+    const char *p;
+
+    for (p = number; *p; p++) {
+        digits += *p >= '0' && *p <= '9';
+    }
+
+    // Use the SMSC stored in the SIM.
+    written += A6writeHex(out, 0x00);
+    // SMS-SUBMIT, with a user data header if concatenated.
+    written += A6writeHex(out, concatenated ? 0x41 : 0x01);
+    // Let the modem pick the message reference.
+    written += A6writeHex(out, 0x00);
+
+    // The destination, with its digits swapped in pairs.
+    written += A6writeHex(out, digits);
+    written += A6writeHex(out, number[0] == '+' ? 0x91 : 0x81);
+    byte pending = 0xFF;
+    for (p = number; *p; p++) {
+        if (*p < '0' || *p > '9') {
+            continue;
+        }
+        if (pending == 0xFF) {
+            pending = *p - '0';
+        } else {
+            written += A6writeHex(out, ((*p - '0') << 4) | pending);
+            pending = 0xFF;
+        }
+    }
+    if (pending != 0xFF) {
+        written += A6writeHex(out, 0xF0 | pending);
+    }
+
+    written += A6writeHex(out, 0x00);
+    written += A6writeHex(out, encoding == A6_ENCODING_GSM7 ? 0x00 : 0x08);
+
+    if (encoding == A6_ENCODING_GSM7) {
+        written += A6writeHex(out, partLength + (concatenated ? 7 : 0));
+    } else {
+        written += A6writeHex(out, partLength * 2 + (concatenated ? 6 : 0));
+    }
+
+    if (concatenated) {
+        // Concatenated SMS, 8-bit reference.
+        written += A6writeHex(out, 0x05);
+        written += A6writeHex(out, 0x00);
+        written += A6writeHex(out, 0x03);
+        written += A6writeHex(out, reference);
+        written += A6writeHex(out, parts);
+        written += A6writeHex(out, part);
+    }
+
+    p = partStart;
+    if (encoding == A6_ENCODING_GSM7) {
+        // Pack the septets, least significant bit first. After a header, the
+        // text starts on a septet boundary, one fill bit in.
+        unsigned int bits = 0;
+        byte count = concatenated ? 1 : 0;
+
+        while (p < partEnd) {
+            byte septets[2];
+            byte len = A6gsmEncode(A6utf8Next(&p), septets);
+
+            for (byte i = 0; i < len; i++) {
+                bits |= septets[i] << count;
+                count += 7;
+                while (count >= 8) {
+                    written += A6writeHex(out, bits & 0xFF);
+                    bits >>= 8;
+                    count -= 8;
+                }
+            }
+        }
+        if (count > 0) {
+            written += A6writeHex(out, bits & 0xFF);
+        }
+    } else {
+        written += A6writeUCS2(out, partStart, partEnd);
+    }
+    return written;
+}
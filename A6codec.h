@@ -0,0 +1,67 @@
+#ifndef A6codec_h
+#define A6codec_h
+
+#include <Arduino.h>
+
+#define A6_ENCODING_GSM7 0
+#define A6_ENCODING_UCS2 1
+
+// Decode the UTF-8 character at *p and move *p past it. Returns 0 at the end
+// of the string, and U+FFFD for invalid sequences.
+unsigned long A6utf8Next(const char **p);
+
+// How many GSM 03.38 septets the character takes (2 for the ones in the
+// extension table), or 0 if it isn't in the GSM alphabet.
+byte A6gsmLength(unsigned long c);
+
+// Write the septets for the character to septets (which must have room for
+// two), returning how many were written, or 0 if it isn't in the GSM alphabet.
+byte A6gsmEncode(unsigned long c, byte *septets);
+
+
+// Write UTF-8 text as UCS2 hex (as the modem expects with AT+CSCS="UCS2"),
+// up to end or the end of the string. Returns the number of bytes written.
+size_t A6writeUCS2(Print &out, const char *text);
+size_t A6writeUCS2(Print &out, const char *text, const char *end);
+
+// Turn UCS2 hex (as the modem sends with AT+CSCS="UCS2") into UTF-8, in place.
+// Returns false, leaving text alone, if it isn't UCS2 hex.
+bool A6decodeUCS2(char *text);
+
+
+// Encodes an SMS as PDU mode SMS-SUBMIT messages, splitting it into a
+// concatenated SMS if it doesn't fit in one. It picks GSM 03.38 if every
+// character is in the GSM alphabet and UCS2 otherwise, whichever needs fewer
+// parts. The PDUs are written straight to a Print as hex, so the text is never
+// copied; it and the number must stay valid while encoding.
+class A6pduEncoder {
+public:
+    // text is UTF-8. reference identifies the parts of a concatenated SMS,
+    // and should be different for every message.
+    void begin(const char *number, const char *text, byte reference);
+    byte getEncoding();
+    byte getParts();
+    // Move on to the next part, returning its TPDU length in octets (what
+    // AT+CMGS wants), or 0 if there are no more parts.
+    int nextPart();
+    // Write the current part, as hex. Returns the number of bytes written.
+    size_t write(Print &out);
+private:
+    const char *number;
+    const char *text;
+    byte reference;
+    byte encoding;
+    byte parts;
+    byte part;
+    // Where the current part starts and ends in text, and how many septets
+    // (GSM) or UCS2 units it is.
+    const char *partStart;
+    const char *partEnd;
+    int partLength;
+
+    byte charLength(unsigned long c);
+    int partLimit();
+    const char *fillPart(const char *start, int *length);
+};
+
+#endif
@@ -0,0 +1,230 @@
+#include <Arduino.h>
+#include "A6lib.h"
+#include "A6parse.h"
+
+#ifdef ESP8266
+#define min _min
+#define max _max
+#endif
+
+// GPRS and TCP sockets, with the modem in multi-connection mode (AT+CIPMUX=1).
+
+/////////////////////////////////////////////
+// Public methods.
+//
+
+// Attach to GPRS and activate a PDP context with the given APN.
+byte A6lib::connectGPRS(const char *apn) {
+    char buffer[A6_CMD_MAXLEN];
+
+    // Don't attach with an APN that doesn't fit, and would be cut short.
+    if (snprintf(buffer, sizeof(buffer), "AT+CGDCONT=1,\"IP\",\"%s\"", apn) >= (int)sizeof(buffer)) {
+        return A6_NOTOK;
+    }
+
+    if (A6command("AT+CGATT=1", "OK", "yy", A6_CONNECT_TIMEOUT, 2, NULL) != A6_OK) {
+        return A6_NOTOK;
+    }
+
+    if (A6command(buffer, "OK", "yy", A6_ADAPTIVE, 2, NULL) != A6_OK) {
+        return A6_NOTOK;
+    }
+
+    if (A6command("AT+CGACT=1,1", "OK", "yy", A6_CONNECT_TIMEOUT, 2, NULL) != A6_OK) {
+        return A6_NOTOK;
+    }
+
+    return A6command("AT+CIPMUX=1", "OK", "yy", A6_ADAPTIVE, 2, NULL);
+}
+
+
+// Deactivate the PDP context and detach from GPRS, which closes all sockets.
+byte A6lib::disconnectGPRS() {
+    for (byte i = 0; i < A6_MAX_SOCKETS; i++) {
+        sockets[i].open = false;
+    }
+
+    A6command("AT+CGACT=0,1", "OK", "yy", A6_CONNECT_TIMEOUT, 2, NULL);
+    return A6command("AT+CGATT=0", "OK", "yy", A6_CONNECT_TIMEOUT, 2, NULL);
+}
+
+
+struct A6lineSearch {
+    const char *text;
+    bool found;
+};
+
+static void A6searchLine(const char *line, void *context) {
+    A6lineSearch *search = (A6lineSearch *)context;
+
+    if (strstr(line, search->text) != NULL) {
+        search->found = true;
+    }
+}
+
+
+// Open a TCP connection. Returns the socket, or -1 if it couldn't connect.
+// Data received over it is passed to callback from poll() (or while a blocking
+// command waits), so callback should only queue commands with submit().
+int A6lib::openSocket(const char *host, int port, A6socketCallback callback, void *context) {
+    char buffer[A6_CMD_MAXLEN];
+    A6lineSearch search = { "CONNECT OK", false };
+    int socket = 0;
+
+    while (socket < A6_MAX_SOCKETS && sockets[socket].open) {
+        socket++;
+    }
+    if (socket == A6_MAX_SOCKETS) {
+        return -1;
+    }
+
+    if (snprintf(buffer, sizeof(buffer), "AT+CIPSTART=%d,\"TCP\",\"%s\",%d", socket, host, port) >= (int)sizeof(buffer)) {
+        return -1;
+    }
+
+    // The modem replies OK at once and "<socket>, CONNECT OK" (or CONNECT FAIL)
+    // once it has connected.
+    A6command(buffer, "CONNECT", "yy", A6_CONNECT_TIMEOUT, 1, NULL, A6searchLine, &search);
+    if (!search.found) {
+        return -1;
+    }
+
+    A6socket *s = &sockets[socket];
+    memset(s, 0, sizeof(*s));
+    s->open = true;
+    s->callback = callback;
+    s->context = context;
+    s->stats.openedAt = millis();
+    return socket;
+}
+
+
+struct A6buffer {
+    const byte *data;
+    size_t length;
+};
+
+static size_t A6writeBuffer(Print &out, void *context) {
+    A6buffer *buffer = (A6buffer *)context;
+
+    return out.write(buffer->data, buffer->length);
+}
+
+
+// Send data over a socket, straight from data, and block until the modem has
+// accepted it.
+byte A6lib::sendSocket(byte socket, const byte *data, size_t length) {
+    A6buffer buffer = { data, length };
+
+    return sendSocket(socket, length, A6writeBuffer, &buffer);
+}
+
+
+// Send length bytes over a socket, written by writer once the modem is ready
+// for them, so the data can be produced as it's sent instead of being buffered.
+// writer must write exactly length bytes.
+byte A6lib::sendSocket(byte socket, size_t length, A6writeCallback writer, void *context) {
+    char buffer[30];
+    A6lineSearch search = { "SEND OK", false };
+
+    if (socket >= A6_MAX_SOCKETS || !sockets[socket].open) {
+        return A6_NOTOK;
+    }
+
+    A6socketStats *stats = &sockets[socket].stats;
+    unsigned long start = millis();
+
+    // The modem replies "<socket>, SEND OK" (or SEND FAIL).
+    sprintf(buffer, "AT+CIPSEND=%d,%u", socket, (unsigned int)length);
+    A6command(buffer, "SEND", "yy", A6_SEND_TIMEOUT, 1, NULL, A6searchLine, &search, writer, context);
+
+    if (!search.found) {
+        stats->failedSends++;
+        return A6_NOTOK;
+    }
+
+    unsigned long latency = millis() - start;
+    stats->sends++;
+    stats->bytesSent += length;
+    stats->totalSendLatency += latency;
+    stats->maxSendLatency = max(stats->maxSendLatency, latency);
+    return A6_OK;
+}
+
+
+byte A6lib::closeSocket(byte socket) {
+    char buffer[20];
+
+    if (socket >= A6_MAX_SOCKETS || !sockets[socket].open) {
+        return A6_NOTOK;
+    }
+
+    sockets[socket].open = false;
+    sprintf(buffer, "AT+CIPCLOSE=%d", socket);
+    return A6command(buffer, "CLOSE OK", "yy", A6_ADAPTIVE, 2, NULL);
+}
+
+
+const A6socketStats &A6lib::getSocketStats(byte socket) {
+    return sockets[socket < A6_MAX_SOCKETS ? socket : 0].stats;
+}
+
+
+/////////////////////////////////////////////
+// Private methods.
+//
+
+// Hand the +CIPRCV data that has arrived so far to its socket, straight from
+// the serial connection. Returns the number of bytes read.
+int A6lib::receiveData() {
+    byte chunk[A6_SOCKET_CHUNK];
+    unsigned int length = 0;
+
+    while (length < sizeof(chunk) && length < rawRemaining && A6conn->available() > 0) {
+        chunk[length++] = A6conn->read();
+    }
+    rawRemaining -= length;
+
+    if (rawSocket < A6_MAX_SOCKETS && sockets[rawSocket].open) {
+        A6socket *s = &sockets[rawSocket];
+
+        s->stats.bytesReceived += length;
+        if (s->callback != NULL) {
+            s->callback(rawSocket, chunk, length, s->context);
+        }
+    }
+    return length;
+}
+
+
+// Look for the modem telling us a connection was closed ("<socket>, CLOSED")
+// or that all of them were ("+PDP: DEACT"). Returns whether line was one of
+// those.
+bool A6lib::socketLine(const char *line) {
+    int socket;
+
+    if (strncmp(line, "+PDP: DEACT", 11) == 0) {
+        for (byte i = 0; i < A6_MAX_SOCKETS; i++) {
+            if (sockets[i].open) {
+                sockets[i].open = false;
+                if (sockets[i].callback != NULL) {
+                    sockets[i].callback(i, NULL, 0, sockets[i].context);
+                }
+            }
+        }
+        return false;
+    }
+
+    if (A6parse(line, "", A6int(socket)) != 1 || socket < 0 || socket >= A6_MAX_SOCKETS || strstr(line, "CLOSED") == NULL) {
+        return false;
+    }
+
+    A6socket *s = &sockets[socket];
+    if (s->open) {
+        s->open = false;
+        if (s->callback != NULL) {
+            s->callback(socket, NULL, 0, s->context);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,336 @@
+#include <Arduino.h>
+#include "A6http.h"
+
+#ifdef ESP8266
+#define min _min
+#define max _max
+#endif
+
+// Counts what is written to it, to find out how long the request header is
+// before sending it.
+class A6lengthPrint : public Print {
+public:
+    size_t length;
+
+    A6lengthPrint() {
+        length = 0;
+    }
+    size_t write(uint8_t c) {
+        (void)c;
+        length++;
+        return 1;
+    }
+};
+
+
+A6http::A6http(A6lib &modem) {
+    this->modem = &modem;
+    socket = -1;
+    host[0] = 0;
+    port = 0;
+    state = A6_HTTP_IDLE;
+}
+
+
+int A6http::get(const char *host, int port, const char *path, A6httpReader reader, void *context) {
+    return request("GET", host, port, path, NULL, 0, NULL, NULL, reader, context);
+}
+
+
+// POST a body of contentLength bytes, which writer writes as it's sent.
+int A6http::post(const char *host, int port, const char *path, const char *contentType, size_t contentLength, A6httpWriter writer, A6httpReader reader, void *context) {
+    return request("POST", host, port, path, contentType, contentLength, writer, NULL, reader, context);
+}
+
+
+int A6http::request(const char *method, const char *host, int port, const char *path, const char *contentType, size_t contentLength, A6httpWriter writer, A6lineCallback headerCallback, A6httpReader reader, void *context) {
+    this->method = method;
+    requestHost = host;
+    requestPort = port;
+    this->path = path;
+    this->contentType = contentType;
+    this->contentLength = contentLength;
+    this->writer = writer;
+    this->headerCallback = headerCallback;
+    this->reader = reader;
+    this->context = context;
+
+    // If the server has closed a kept-alive connection in the meantime,
+    // sending fails, so try again once over a new one.
+    bool reused = socket >= 0 && port == this->port && strcmp(host, this->host) == 0;
+    A6lengthPrint header;
+    writeHeader(header);
+
+    for (;;) {
+        if (!connect(host, port)) {
+            return A6_HTTP_CONNECT_FAILED;
+        }
+
+        state = A6_HTTP_STATUS;
+        lineLength = 0;
+        status = 0;
+        closed = false;
+        receivedAt = millis();
+
+        if (modem->sendSocket(socket, header.length, writeHeader, this) == A6_OK) {
+            break;
+        }
+        close();
+        if (!reused) {
+            return A6_HTTP_SEND_FAILED;
+        }
+        reused = false;
+    }
+
+    for (sendOffset = 0; sendOffset < contentLength && writer != NULL; sendOffset += sendLength) {
+        sendLength = min(contentLength - sendOffset, (size_t)A6_HTTP_SEND_SIZE);
+        if (modem->sendSocket(socket, sendLength, writeBody, this) != A6_OK) {
+            close();
+            return A6_HTTP_SEND_FAILED;
+        }
+    }
+
+    // The response is parsed as it comes in, by received().
+    while (state != A6_HTTP_DONE) {
+        modem->poll();
+        if (closed && state != A6_HTTP_DONE) {
+            state = A6_HTTP_IDLE;
+            return A6_HTTP_CLOSED;
+        }
+        if (millis() - receivedAt > A6_HTTP_TIMEOUT) {
+            close();
+            state = A6_HTTP_IDLE;
+            return A6_HTTP_TIMED_OUT;
+        }
+#ifdef ESP8266
+        yield();
+#endif
+    }
+    state = A6_HTTP_IDLE;
+
+    if (!keepAlive) {
+        close();
+    }
+    return status;
+}
+
+
+void A6http::close() {
+    if (socket >= 0) {
+        modem->closeSocket(socket);
+        socket = -1;
+    }
+}
+
+
+// Open a connection to host, unless the one we have is to it already.
+bool A6http::connect(const char *host, int port) {
+    if (socket >= 0 && port == this->port && strcmp(host, this->host) == 0) {
+        return true;
+    }
+
+    close();
+    socket = modem->openSocket(host, port, received, this);
+    if (socket < 0) {
+        return false;
+    }
+
+    // Hosts that don't fit are never reused.
+    if (strlen(host) < sizeof(this->host)) {
+        strcpy(this->host, host);
+    } else {
+        this->host[0] = 0;
+    }
+    this->port = port;
+    return true;
+}
+
+
+size_t A6http::writeHeader(Print &out) {
+    size_t written = 0;
+
+    written += out.print(method);
+    written += out.print(' ');
+    written += out.print(path);
+    written += out.print(" HTTP/1.1\r\nHost: ");
+    written += out.print(requestHost);
+    if (requestPort != 80) {
+        written += out.print(':');
+        written += out.print(requestPort);
+    }
+    written += out.print("\r\n");
+    if (contentType != NULL) {
+        written += out.print("Content-Type: ");
+        written += out.print(contentType);
+        written += out.print("\r\n");
+    }
+    // A POST or PUT without a body still needs a length, or the server waits
+    // for one.
+    if (writer != NULL || strcmp(method, "POST") == 0 || strcmp(method, "PUT") == 0) {
+        written += out.print("Content-Length: ");
+        written += out.print(writer != NULL ? (unsigned long)contentLength : 0UL);
+        written += out.print("\r\n");
+    }
+    written += out.print("\r\n");
+    return written;
+}
+
+
+size_t A6http::writeHeader(Print &out, void *context) {
+    return ((A6http *)context)->writeHeader(out);
+}
+
+
+size_t A6http::writeBody(Print &out, void *context) {
+    A6http *http = (A6http *)context;
+
+    http->writer(out, http->sendOffset, http->sendLength, http->context);
+    return http->sendLength;
+}
+
+
+void A6http::received(byte socket, const byte *data, size_t length, void *context) {
+    A6http *http = (A6http *)context;
+
+    (void)socket;
+    http->receivedAt = millis();
+    if (length == 0) {
+        // Without a length, the body ends when the connection does.
+        http->closed = true;
+        http->socket = -1;
+        if (http->state == A6_HTTP_BODY && !http->lengthKnown) {
+            http->state = A6_HTTP_DONE;
+        }
+        return;
+    }
+    http->parse(data, length);
+}
+
+
+// Parse the next piece of the response. Body data is passed on to the reader
+// as it is, without copying.
+size_t A6http::parse(const byte *data, size_t length) {
+    size_t i = 0;
+
+    while (i < length) {
+        if (state == A6_HTTP_BODY || state == A6_HTTP_CHUNK) {
+            size_t n = length - i;
+
+            if (lengthKnown || state == A6_HTTP_CHUNK) {
+                n = min((unsigned long)n, remaining);
+                remaining -= n;
+            }
+            if (reader != NULL) {
+                reader(data + i, n, context);
+            }
+            i += n;
+
+            if ((lengthKnown || state == A6_HTTP_CHUNK) && remaining == 0) {
+                state = state == A6_HTTP_CHUNK ? A6_HTTP_CHUNK_END : A6_HTTP_DONE;
+            }
+        } else if (state == A6_HTTP_IDLE || state == A6_HTTP_DONE) {
+            // Nothing was asked for, so ignore it.
+            i = length;
+        } else {
+            char c = data[i++];
+
+            if (c == '\n') {
+                if (lineLength > 0 && line[lineLength - 1] == '\r') {
+                    lineLength--;
+                }
+                line[lineLength] = 0;
+                lineReceived();
+                lineLength = 0;
+            } else if (lineLength < sizeof(line) - 1) {
+                line[lineLength++] = c;
+            }
+        }
+    }
+    return i;
+}
+
+
+// Handle a complete status, header, chunk size or trailer line.
+void A6http::lineReceived() {
+    switch (state) {
+    case A6_HTTP_STATUS:
+        if (strncmp(line, "HTTP/", 5) != 0) {
+            // Stray blank lines before the response.
+            break;
+        }
+        // HTTP/1.0 servers close the connection after every response, unless
+        // they say otherwise.
+        keepAlive = strncmp(line, "HTTP/1.0", 8) != 0;
+        status = strchr(line, ' ') != NULL ? atoi(strchr(line, ' ') + 1) : 0;
+        chunked = false;
+        lengthKnown = false;
+        remaining = 0;
+        state = A6_HTTP_HEADERS;
+        break;
+
+    case A6_HTTP_HEADERS:
+        if (lineLength == 0) {
+            headersDone();
+            break;
+        }
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            lengthKnown = true;
+            remaining = strtoul(line + 15, NULL, 10);
+        } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+            chunked = strstr(line + 18, "chunked") != NULL;
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            const char *value = line + 11;
+
+            while (*value == ' ') {
+                value++;
+            }
+            if (strncasecmp(value, "close", 5) == 0) {
+                keepAlive = false;
+            } else if (strncasecmp(value, "keep-alive", 10) == 0) {
+                keepAlive = true;
+            }
+        }
+        if (headerCallback != NULL) {
+            headerCallback(line, context);
+        }
+        break;
+
+    case A6_HTTP_CHUNK_SIZE:
+        remaining = strtoul(line, NULL, 16);
+        state = remaining > 0 ? A6_HTTP_CHUNK : A6_HTTP_TRAILERS;
+        break;
+
+    case A6_HTTP_CHUNK_END:
+        state = A6_HTTP_CHUNK_SIZE;
+        break;
+
+    case A6_HTTP_TRAILERS:
+        if (lineLength == 0) {
+            state = A6_HTTP_DONE;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+// Work out how the body is delimited, now that all the headers are in.
+void A6http::headersDone() {
+    if (status >= 100 && status < 200) {
+        // An interim response (e.g. 100 Continue), the real one follows.
+        state = A6_HTTP_STATUS;
+    } else if (strcmp(method, "HEAD") == 0 || status == 204 || status == 304) {
+        state = A6_HTTP_DONE;
+    } else if (chunked) {
+        lengthKnown = false;
+        state = A6_HTTP_CHUNK_SIZE;
+    } else if (lengthKnown) {
+        state = remaining > 0 ? A6_HTTP_BODY : A6_HTTP_DONE;
+    } else {
+        // The body lasts until the connection closes.
+        keepAlive = false;
+        state = A6_HTTP_BODY;
+    }
+}
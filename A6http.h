@@ -0,0 +1,110 @@
+#ifndef A6http_h
+#define A6http_h
+
+#include <Arduino.h>
+#include "A6lib.h"
+
+// The longest status, header or chunk size line that is parsed. The rest of
+// longer lines is ignored.
+#ifndef A6_HTTP_LINE_SIZE
+#define A6_HTTP_LINE_SIZE 128
+#endif
+#define A6_HTTP_HOST_SIZE 64
+// How much of a request body is sent with each AT+CIPSEND.
+#define A6_HTTP_SEND_SIZE 1024
+// How long to wait for more of a response, in ms.
+#define A6_HTTP_TIMEOUT 30000
+
+// request() returns these (negative) instead of an HTTP status when it fails.
+#define A6_HTTP_CONNECT_FAILED -1
+#define A6_HTTP_SEND_FAILED -2
+#define A6_HTTP_TIMED_OUT -3
+#define A6_HTTP_CLOSED -4
+
+// Write bytes offset to offset + length of a request body to out, exactly
+// length of them.
+typedef void (*A6httpWriter)(Print &out, size_t offset, size_t length, void *context);
+
+// Called with every piece of a response body, as it comes in.
+typedef void (*A6httpReader)(const byte *data, size_t length, void *context);
+
+enum A6httpState {
+    A6_HTTP_IDLE,
+    A6_HTTP_STATUS,
+    A6_HTTP_HEADERS,
+    A6_HTTP_BODY,
+    A6_HTTP_CHUNK_SIZE,
+    A6_HTTP_CHUNK,
+    A6_HTTP_CHUNK_END,
+    A6_HTTP_TRAILERS,
+    A6_HTTP_DONE
+};
+
+// An HTTP/1.1 client over the modem's TCP sockets. Request bodies are written
+// by a callback as they are sent, and response bodies are passed to a callback
+// as they arrive, so neither has to fit in memory. Responses can have a
+// Content-Length, be chunked or last until the connection closes. The
+// connection is kept open between requests to the same host, as setting one
+// up over GPRS takes seconds.
+//
+//     A6http http(A6c);
+//
+//     int status = http.get("example.com", 80, "/config", onBody, NULL);
+class A6http {
+public:
+    A6http(A6lib &modem);
+
+    int get(const char *host, int port, const char *path, A6httpReader reader, void *context);
+    int post(const char *host, int port, const char *path, const char *contentType, size_t contentLength, A6httpWriter writer, A6httpReader reader, void *context);
+    // Issue a request and block until the whole response has been received.
+    // Returns the HTTP status, or one of the A6_HTTP_ errors. headerCallback,
+    // if given, is called with every response header line.
+    int request(const char *method, const char *host, int port, const char *path, const char *contentType, size_t contentLength, A6httpWriter writer, A6lineCallback headerCallback, A6httpReader reader, void *context);
+    // Close the kept-alive connection.
+    void close();
+
+private:
+    A6lib *modem;
+    int socket;
+    char host[A6_HTTP_HOST_SIZE];
+    int port;
+
+    // The request in flight.
+    const char *method;
+    const char *requestHost;
+    int requestPort;
+    const char *path;
+    const char *contentType;
+    size_t contentLength;
+    A6httpWriter writer;
+    A6lineCallback headerCallback;
+    A6httpReader reader;
+    void *context;
+    // The part of the body being sent.
+    size_t sendOffset;
+    size_t sendLength;
+
+    // The response being parsed.
+    A6httpState state;
+    int status;
+    bool chunked;
+    bool keepAlive;
+    bool closed;
+    // How much of the body (or the current chunk) is still to come, if known.
+    bool lengthKnown;
+    unsigned long remaining;
+    char line[A6_HTTP_LINE_SIZE];
+    size_t lineLength;
+    unsigned long receivedAt;
+
+    bool connect(const char *host, int port);
+    size_t writeHeader(Print &out);
+    static size_t writeHeader(Print &out, void *context);
+    static size_t writeBody(Print &out, void *context);
+    static void received(byte socket, const byte *data, size_t length, void *context);
+    size_t parse(const byte *data, size_t length);
+    void lineReceived();
+    void headersDone();
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include <Arduino.h>
+#include "A6inbox.h"
+#include "A6parse.h"
+
+A6inbox::A6inbox(A6lib &modem, SMSrecord *slots, int capacity) {
+    this->modem = &modem;
+    this->slots = slots;
+    this->capacity = capacity;
+    count = 0;
+    pendingCount = 0;
+    overflowed = false;
+    missed = false;
+}
+
+
+byte A6inbox::begin() {
+    if (modem->onUnsolicited("+CMTI:", messageArrived, this) != A6_OK) {
+        return A6_NOTOK;
+    }
+    if (modem->enableSMSNotifications(1) != A6_OK) {
+        return A6_NOTOK;
+    }
+    return sync();
+}
+
+
+byte A6inbox::sync() {
+    // Anything announced so far will be in the listing.
+    pendingCount = 0;
+    overflowed = false;
+    missed = false;
+    count = modem->readSMSList(slots, capacity, "ALL");
+    return A6_OK;
+}
+
+
+// Called for "+CMTI: "ME",3". This only notes the index, since handlers can't
+// issue blocking commands.
+void A6inbox::messageArrived(const char *line, void *context) {
+    A6inbox *inbox = (A6inbox *)context;
+    int index;
+
+    if (A6parse(line, "+CMTI:", A6skip(), A6int(index)) != 2) {
+        return;
+    }
+    if (inbox->pendingCount < A6_INBOX_PENDING) {
+        inbox->pending[inbox->pendingCount++] = index;
+    } else {
+        inbox->overflowed = true;
+    }
+}
+
+
+int A6inbox::update() {
+    int added = 0;
+
+    if (overflowed || missed) {
+        if (count >= capacity) {
+            // A listing would mark them all read with nowhere to keep them,
+            // so leave them in the modem until there's room.
+            return 0;
+        }
+        if (missed) {
+            int before = count;
+
+            // There may be more than fit this time too.
+            sync();
+            missed = count == capacity;
+            return max(count - before, 0);
+        }
+        // We lost track of some, but they will still be unread.
+        pendingCount = 0;
+        overflowed = false;
+        return listUnread();
+    }
+
+    while (pendingCount > 0 && count < capacity) {
+        int index = pending[0];
+
+        if (find(index) == NULL) {
+            if (modem->readSMS(index, &slots[count]) == A6_OK) {
+                count++;
+                added++;
+            } else {
+                // Pick it up from the unread listing next time.
+                overflowed = true;
+            }
+        }
+        pendingCount--;
+        memmove(pending, pending + 1, pendingCount * sizeof(pending[0]));
+    }
+    return added;
+}
+
+
+// Add the unread messages to the cache, replacing the cached copies of any
+// that are already in it.
+int A6inbox::listUnread() {
+    int added = 0;
+    int room = capacity - count;
+    int listed = modem->readSMSList(slots + count, room, "REC UNREAD");
+    int end = count + listed;
+
+    // Any that didn't fit were marked read by the listing all the same, so
+    // only a listing of all of them will find them.
+    missed = listed == room;
+
+    for (int i = count; i < end;) {
+        SMSrecord *cached = find(slots[i].index);
+
+        if (cached != NULL) {
+            *cached = slots[i];
+            slots[i] = slots[--end];
+        } else {
+            i++;
+            added++;
+        }
+    }
+    count = end;
+    return added;
+}
+
+
+int A6inbox::getCount() {
+    return count;
+}
+
+
+SMSrecord *A6inbox::get(int i) {
+    if (i < 0 || i >= count) {
+        return NULL;
+    }
+    return &slots[i];
+}
+
+
+SMSrecord *A6inbox::find(int index) {
+    for (int i = 0; i < count; i++) {
+        if (slots[i].index == index) {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+
+byte A6inbox::remove(int index) {
+    SMSrecord *sms = find(index);
+
+    if (modem->deleteSMS(index) != A6_OK) {
+        return A6_NOTOK;
+    }
+    if (sms != NULL) {
+        // Fill the hole with the last one.
+        *sms = slots[--count];
+    }
+    return A6_OK;
+}
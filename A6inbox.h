@@ -0,0 +1,70 @@
+#ifndef A6inbox_h
+#define A6inbox_h
+
+#include <Arduino.h>
+#include "A6lib.h"
+
+// How many +CMTI notifications can be waiting to be fetched. If more arrive,
+// the next update() lists the unread messages instead.
+#ifndef A6_INBOX_PENDING
+#define A6_INBOX_PENDING 8
+#endif
+
+// A copy of the SMS messages stored in the modem, kept in caller-provided
+// records, so they can be looked up without talking to the modem. After the
+// first sync(), only new messages are fetched: the modem announces them with
+// +CMTI, and update() reads just those.
+//
+//     SMSrecord slots[10];
+//     A6inbox inbox(A6c, slots, 10);
+//
+//     inbox.begin();
+//     ...
+//     // In loop():
+//     A6c.poll();
+//     if (inbox.update() > 0) {
+//         ...
+//     }
+class A6inbox {
+public:
+    A6inbox(A6lib &modem, SMSrecord *slots, int capacity);
+
+    // Turn on new message notifications and read all the stored messages.
+    byte begin();
+    // Read all the stored messages again, e.g. if they may have been changed
+    // behind our back. Messages that don't fit are marked read all the same,
+    // and are only picked up by another sync() once some are removed.
+    byte sync();
+    // Fetch the messages that arrived since the last update. Returns how many
+    // were added. Messages that don't fit are left in the modem, unread, until
+    // some are removed.
+    int update();
+
+    int getCount();
+    // The i-th cached message, in no particular order.
+    SMSrecord *get(int i);
+    // The cached message stored at index in the modem, or NULL.
+    SMSrecord *find(int index);
+    // Delete the message from the modem and the cache.
+    byte remove(int index);
+
+private:
+    A6lib *modem;
+    SMSrecord *slots;
+    int capacity;
+    int count;
+
+    // Indices announced by +CMTI that haven't been fetched yet.
+    int pending[A6_INBOX_PENDING];
+    byte pendingCount;
+    // Set if a +CMTI didn't fit in pending.
+    bool overflowed;
+    // Set if a listing filled the cache, so there may be messages in the
+    // modem that aren't cached, and aren't unread any more either.
+    bool missed;
+
+    static void messageArrived(const char *line, void *context);
+    int listUnread();
+};
+
+#endif
@@ -1,28 +1,105 @@
 #include <Arduino.h>
+#ifndef A6_NO_SOFTWARE_SERIAL
 #include <SoftwareSerial.h>
+#endif
 #include "A6lib.h"
+#include "A6parse.h"
 
 #ifdef ESP8266
 #define min _min
 #define max _max
 #endif
 
+#if A6_TRACE_LEVEL > 0
+#define A6_TRACE(level, event, value) do { if ((level) <= A6_TRACE_LEVEL) { trace(event, value); } } while (0)
+#else
+#define A6_TRACE(level, event, value) do { } while (0)
+#endif
+
+template <class T, size_t N> static constexpr size_t A6countof(T (&)[N]) {
+    return N;
+}
+
 /////////////////////////////////////////////
 // Public methods.
 //
 
+#ifndef A6_NO_SOFTWARE_SERIAL
 A6lib::A6lib(int transmitPin, int receivePin) {
 #ifdef ESP8266
-    A6conn = new SoftwareSerial(receivePin, transmitPin, false, 1024);
+    softwareSerial = new SoftwareSerial(receivePin, transmitPin, false, 1024);
 #else
-    A6conn = new SoftwareSerial(receivePin, transmitPin, false);
+    softwareSerial = new SoftwareSerial(receivePin, transmitPin, false);
 #endif
-    A6conn->setTimeout(100);
+    init(softwareSerial, A6beginSerial<SoftwareSerial>);
 }
+#endif
 
 
 A6lib::~A6lib() {
-    delete A6conn;
+#ifndef A6_NO_SOFTWARE_SERIAL
+    delete softwareSerial;
+#endif
+}
+
+
+void A6lib::init(Stream *serial, A6beginCallback begin) {
+    A6conn = serial;
+    beginSerial = begin;
+
+    queueHead = 0;
+    queueCount = 0;
+    waiting = false;
+    attempt = 0;
+    sentAt = 0;
+    firstSentAt = 0;
+    attemptTimeout = 0;
+    backingOff = false;
+    retryAt = 0;
+    prompting = false;
+    dataSent = false;
+    replyStarted = false;
+    replyStartedAt = 0;
+    stats = NULL;
+    resetMetrics();
+    replyTimeCount = 0;
+    replyTime = NULL;
+#if A6_TRACE_LEVEL > 0
+    traceHead = 0;
+    traceCount = 0;
+    traceNameCount = 0;
+#endif
+    rxLength = 0;
+    lineStart = 0;
+    rxBuffer[0] = 0;
+    rate = 0;
+    knownRate = 0;
+    rateLoad = NULL;
+    rateSave = NULL;
+    rateContext = NULL;
+    booting = false;
+    bootReady = false;
+    bootLatency = 0;
+    urcHandlerCount = 0;
+    matched = false;
+    receivedAt = 0;
+    inMessageBody = false;
+    result = A6_PENDING;
+    lastError = 0;
+    smsReference = 0;
+    smsDecoding = false;
+    smsPeeking = true;
+    smsHead = 0;
+    smsCount = 0;
+    smsStarted = false;
+    smsPartLength = 0;
+    smsBusy = false;
+    smsAttempt = 0;
+    smsRetryAt = 0;
+    pduMode = false;
+    memset(sockets, 0, sizeof(sockets));
+    rawRemaining = 0;
+    rawSocket = 0;
 }
 
 
@@ -30,6 +107,8 @@ A6lib::~A6lib() {
 byte A6lib::blockUntilReady(long baudRate) {
 
     byte response = A6_NOTOK;
+    unsigned long wait = 100;
+
     while (A6_OK != response) {
         response = begin(baudRate);
         // This means the modem has failed to initialize and we need to reboot
@@ -37,8 +116,11 @@ byte A6lib::blockUntilReady(long baudRate) {
         if (A6_FAILURE == response) {
             return A6_FAILURE;
         }
-        delay(1000);
-        logln("Waiting for module to be ready...");
+        if (A6_OK != response) {
+            A6_TRACE(2, A6_TRACE_NOT_READY, response);
+            delay(wait);
+            wait = min(wait * 2, 1000UL);
+        }
     }
     return A6_OK;
 }
@@ -54,57 +136,122 @@ byte A6lib::begin(long baudRate) {
         return A6_NOTOK;
     }
 
-    // Factory reset.
-    A6command("AT&F", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
-
-    // Echo off.
-    A6command("ATE0", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
-
-    // Switch audio to headset.
-    enableSpeaker(0);
-
-    // Set caller ID on.
-    A6command("AT+CLIP=1", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
-
-    // Set SMS to text mode.
-    A6command("AT+CMGF=1", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+    const char *settings[] = {
+        // Factory reset.
+        "AT&F",
+        // Echo off.
+        "ATE0",
+        // Switch audio to headset.
+        "AT+SNFS=0",
+        // Set caller ID on.
+        "AT+CLIP=1",
+        // Set SMS to text mode.
+        "AT+CMGF=1",
+        // Turn SMS indicators off.
+        "AT+CNMI=1,0",
+        // Set SMS storage to the GSM modem. If this doesn't work for you, try
+        // changing the command to: "AT+CPMS=SM,SM,SM"
+        "AT+CPMS=ME,ME,ME",
+        // Set SMS character set.
+        "AT+CSCS=\"UCS2\"",
+    };
+    byte results[A6countof(settings)];
 
-    // Turn SMS indicators off.
-    A6command("AT+CNMI=1,0", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+    // Send the settings in as few command lines as possible.
+    runBatch(settings, A6countof(settings), results);
 
-    // Set SMS storage to the GSM modem. If this doesn't work for you, try changing the command to:
-    // "AT+CPMS=SM,SM,SM"
-    if (A6_OK != A6command("AT+CPMS=ME,ME,ME", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL))
-        // This may sometimes fail, in which case the modem needs to be
-        // rebooted.
-    {
+    // Setting the SMS storage may sometimes fail, in which case the modem
+    // needs to be rebooted.
+    if (A6_OK != results[6]) {
         return A6_FAILURE;
     }
 
-    // Set SMS character set.
-    setSMScharset("UCS2");
-
     return A6_OK;
 }
 
 
 // Reboot the module by setting the specified pin HIGH, then LOW. The pin should
-// be connected to a P-MOSFET, not the A6's POWER pin.
-void A6lib::powerCycle(int pin) {
-    logln("Power-cycling module...");
+// be connected to a P-MOSFET, not the A6's POWER pin. Returns as soon as the
+// module is ready, or A6_TIMEOUT if it isn't within timeout ms.
+byte A6lib::powerCycle(int pin, unsigned long timeout) {
+    A6_TRACE(2, A6_TRACE_POWER_CYCLE, timeout);
 
     powerOff(pin);
 
-    delay(2000);
+    delay(A6_POWER_OFF_TIME);
 
     powerOn(pin);
 
-    // Give the module some time to settle.
-    logln("Done, waiting for the module to initialize...");
-    delay(20000);
-    logln("Done.");
+    byte response = waitUntilReady(timeout);
 
     A6conn->flush();
+
+    return response;
+}
+
+
+// Wait until the module has booted, either because it said so ("Call Ready",
+// or registered on the network) or because it answered a probe saying it's
+// registered. Probes are sent at increasing intervals, so a module that is
+// already up is detected quickly. The time it took is available from
+// getBootLatency().
+byte A6lib::waitUntilReady(unsigned long timeout) {
+    unsigned long start = millis();
+    unsigned long interval = 250;
+    unsigned long nextProbe = start + interval;
+
+    if (rate == 0) {
+        // The connection hasn't been started yet, so start it at the last rate
+        // that worked, if we know it.
+        long lastRate = rateLoad != NULL ? rateLoad(rateContext) : 0;
+        startSerial(lastRate > 0 ? lastRate : 9600);
+    }
+
+    booting = true;
+    bootReady = false;
+
+    while (!bootReady && (millis() - start) < timeout) {
+        poll();
+#ifdef ESP8266
+        yield();
+#endif
+
+        if ((long)(millis() - nextProbe) >= 0) {
+            // The reply is checked as it comes in, like the unsolicited
+            // lines.
+            A6command("AT+CREG?", "OK", "yy", 200, 1, NULL);
+
+            interval = min(interval * 2, 2000UL);
+            nextProbe = millis() + interval;
+        }
+    }
+
+    booting = false;
+    bootLatency = millis() - start;
+
+    if (!bootReady) {
+        A6_TRACE(1, A6_TRACE_BOOT_TIMEOUT, bootLatency);
+        return A6_TIMEOUT;
+    }
+    A6_TRACE(2, A6_TRACE_BOOT_READY, bootLatency);
+    return A6_OK;
+}
+
+
+// Remember the baud rate the module works at somewhere that survives a reboot
+// (e.g. EEPROM), so it can be found faster next time. load is only called
+// during rate detection, and save only when the rate changes.
+void A6lib::setRateStore(A6rateLoad load, A6rateSave save, void *context) {
+    rateLoad = load;
+    rateSave = save;
+    rateContext = context;
+}
+
+
+// How long the module took to become ready the last time waitUntilReady() (or
+// powerCycle()) was called.
+unsigned long A6lib::getBootLatency() {
+    return bootLatency;
 }
 
 
@@ -123,81 +270,119 @@ void A6lib::powerOn(int pin) {
 
 
 // Dial a number.
-void A6lib::dial(String number) {
+void A6lib::dial(const String &number) {
+    dial(number.c_str());
+}
+
+
+void A6lib::dial(const char *number) {
     char buffer[50];
 
-    logln("Dialing number...");
+    A6_TRACE(2, A6_TRACE_DIAL, strlen(number));
 
-    sprintf(buffer, "ATD%s;", number.c_str());
+    snprintf(buffer, sizeof(buffer), "ATD%s;", number);
     A6command(buffer, "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
 }
 
 
 // Redial the last number.
 void A6lib::redial() {
-    logln("Redialing last number...");
+    A6_TRACE(2, A6_TRACE_REDIAL, 0);
     A6command("AT+DLST", "OK", "CONNECT", A6_CMD_TIMEOUT, 2, NULL);
 }
 
 
 // Answer a call.
 void A6lib::answer() {
-    A6command("ATA", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+    A6command("ATA", "OK", "yy", A6_ADAPTIVE, 2, NULL);
 }
 
 
 // Hang up the phone.
 void A6lib::hangUp() {
-    A6command("ATH", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+    A6command("ATH", "OK", "yy", A6_ADAPTIVE, 2, NULL);
+}
+
+
+struct A6capture {
+    const char *prefix;
+    char *line;
+    size_t size;
+};
+
+// Keep the reply line that starts with the given prefix.
+static void A6captureLine(const char *line, void *context) {
+    A6capture *capture = (A6capture *)context;
+
+    if (strncmp(line, capture->prefix, strlen(capture->prefix)) == 0) {
+        strncpy(capture->line, line, capture->size - 1);
+        capture->line[capture->size - 1] = 0;
+    }
+}
+
+
+// Issue a command and store the reply line starting with prefix in line.
+// line is left empty if there was no such line.
+byte A6lib::A6query(const char *command, const char *prefix, char *line, size_t size, int timeout, int repetitions) {
+    A6capture capture = { prefix, line, size };
+
+    line[0] = 0;
+    return A6command(command, "OK", "yy", timeout, repetitions, NULL, A6captureLine, &capture);
 }
 
 
 // Check whether there is an active call.
 callInfo A6lib::checkCallStatus() {
-    char number[50];
-    String response = "";
-    uint32_t respStart = 0;
-    callInfo cinfo = (const struct callInfo) {
-        0
-    };
+    callRecord call;
+    callInfo cinfo;
+
+    // Fill in the result in place, so it's returned without copying its
+    // String. call is all zeroes if there is no call.
+    checkCallStatus(&call);
+    cinfo.index = call.index;
+    cinfo.direction = call.direction;
+    cinfo.state = call.state;
+    cinfo.mode = call.mode;
+    cinfo.multiparty = call.multiparty;
+    if (call.number[0] != 0) {
+        cinfo.number = call.number;
+    }
+    cinfo.type = call.type;
+    return cinfo;
+}
+
+
+// Check the status of the current call, without allocating. Returns A6_NOTOK
+// if there is no call.
+byte A6lib::checkCallStatus(callRecord *call) {
+    char line[80];
+
+    memset(call, 0, sizeof(*call));
 
     // Issue the command and wait for the response.
-    A6command("AT+CLCC", "OK", "+CLCC", A6_CMD_TIMEOUT, 2, &response);
+    A6query("AT+CLCC", "+CLCC:", line, sizeof(line), A6_ADAPTIVE, 2);
 
     // Parse the response if it contains a valid +CLCC.
-    respStart = response.indexOf("+CLCC");
-    if (respStart >= 0) {
-        sscanf(response.substring(respStart).c_str(), "+CLCC: %d,%d,%d,%d,%d,\"%s\",%d", &cinfo.index, &cinfo.direction, &cinfo.state, &cinfo.mode, &cinfo.multiparty, number, &cinfo.type);
-        cinfo.number = String(number);
-    }
-
-    uint8_t comma_index = cinfo.number.indexOf('"');
-    if (comma_index != -1) {
-        logln("Extra comma found.");
-        cinfo.number = cinfo.number.substring(0, comma_index);
+    if (A6parse(line, "+CLCC:", A6int(call->index), A6int(call->direction), A6int(call->state), A6int(call->mode), A6int(call->multiparty), A6text(call->number), A6int(call->type)) < 6) {
+        memset(call, 0, sizeof(*call));
+        return A6_NOTOK;
     }
-
-    return cinfo;
+    return A6_OK;
 }
 
 
 // Get the strength of the GSM signal.
 int A6lib::getSignalStrength() {
-    String response = "";
-    uint32_t respStart = 0;
-    int strength, error  = 0;
+    char line[30];
+    int strength, error = 0;
 
     // Issue the command and wait for the response.
-    A6command("AT+CSQ", "OK", "+CSQ", A6_CMD_TIMEOUT, 2, &response);
+    A6query("AT+CSQ", "+CSQ:", line, sizeof(line), A6_ADAPTIVE, 2);
 
-    respStart = response.indexOf("+CSQ");
-    if (respStart < 0) {
+    if (A6parse(line, "+CSQ:", A6int(strength), A6int(error)) < 1) {
         return 0;
     }
 
-    sscanf(response.substring(respStart).c_str(), "+CSQ: %d,%d",
-           &strength, &error);
-
     // Bring value range 0..31 to 0..100%, don't mind rounding..
     strength = (strength * 100) / 31;
     return strength;
@@ -206,42 +391,106 @@ int A6lib::getSignalStrength() {
 
 // Get the real time from the modem. Time will be returned as yy/MM/dd,hh:mm:ss+XX
 String A6lib::getRealTimeClock() {
-    String response = "";
+    char time[A6_DATE_SIZE];
 
-    // Issue the command and wait for the response.
-    A6command("AT+CCLK?", "OK", "yy", A6_CMD_TIMEOUT, 1, &response);
-    int respStart = response.indexOf("+CCLK: \"") + 8;
-    response.setCharAt(respStart - 1, '-');
+    getRealTimeClock(time, sizeof(time));
+    return time;
+}
+
+
+// Get the real time from the modem into time, which should have room for
+// A6_DATE_SIZE characters.
+byte A6lib::getRealTimeClock(char *time, size_t size) {
+    char line[40];
+
+    time[0] = 0;
 
-    return response.substring(respStart, response.indexOf("\""));
+    // Issue the command and wait for the response.
+    A6query("AT+CCLK?", "+CCLK:", line, sizeof(line), A6_ADAPTIVE, 1);
+    if (A6parse(line, "+CCLK:", A6text(time, size)) != 1) {
+        return A6_NOTOK;
+    }
+    return A6_OK;
 }
 
 
 // Send an SMS.
-byte A6lib::sendSMS(String number, String text) {
-    char ctrlZ[2] = { 0x1a, 0x00 };
-    char buffer[100];
+byte A6lib::sendSMS(const String &number, const String &text) {
+    return sendSMS(number.c_str(), text.c_str());
+}
 
-    if (text.length() > 159) {
-        // We can't send messages longer than 160 characters.
-        return A6_NOTOK;
+
+struct A6smsStatus {
+    bool done;
+    byte result;
+};
+
+static void A6smsSent(byte result, int reference, void *context) {
+    A6smsStatus *status = (A6smsStatus *)context;
+
+    (void)reference;
+    status->done = true;
+    status->result = result;
+}
+
+
+// Send an SMS, given as UTF-8, and block until the network has accepted it.
+// See queueSMS().
+byte A6lib::sendSMS(const char *number, const char *text) {
+    A6smsStatus status = { false, A6_NOTOK };
+
+    // Wait for room in the queue if other messages are being sent.
+    while (queueSMS(number, text, A6smsSent, &status) != A6_OK) {
+        poll();
+#ifdef ESP8266
+        yield();
+#endif
+    }
+
+    while (!status.done) {
+        poll();
+#ifdef ESP8266
+        yield();
+#endif
     }
 
-    log("Sending SMS to ");
-    log(number);
-    logln("...");
+    return status.result == A6_OK ? A6_OK : A6_NOTOK;
+}
+
+
+// Queue an SMS, given as UTF-8, to be sent by poll(). This returns
+// immediately, and callback is called once the network has accepted the
+// message, or sending it has failed A6_SMS_ATTEMPTS times. number and text
+// must stay valid until then.
+//
+// Messages are sent in PDU mode, as a concatenated SMS if they don't fit in
+// one, encoded in GSM 03.38 if possible (160 characters per part) and in UCS2
+// otherwise (70 characters per part). Every part is encoded straight to the
+// modem once it prompts for it, and the next message is sent as soon as the
+// network has accepted the last one, so a burst of messages goes out as fast
+// as the modem can take them.
+byte A6lib::queueSMS(const char *number, const char *text, A6smsCallback callback, void *context) {
+    if (smsCount >= A6_SMS_QUEUE_SIZE) {
+        return A6_NOTOK;
+    }
 
-    sprintf(buffer, "AT+CMGS=\"%s\"", number.c_str());
-    A6command(buffer, ">", "yy", A6_CMD_TIMEOUT, 2, NULL);
-    delay(100);
-    A6conn->println(text.c_str());
-    A6conn->println(ctrlZ);
-    A6conn->println();
+    A6outboundSMS *sms = &smsQueue[(smsHead + smsCount) % A6_SMS_QUEUE_SIZE];
+    sms->number = number;
+    sms->text = text;
+    sms->callback = callback;
+    sms->context = context;
+    smsCount++;
 
     return A6_OK;
 }
 
 
+// How many SMS are queued or being sent.
+byte A6lib::getQueuedSMSCount() {
+    return smsCount;
+}
+
+
 // Retrieve the number and locations of unread SMS messages.
 int A6lib::getUnreadSMSLocs(int* buf, int maxItems) {
     return getSMSLocsOfType(buf, maxItems, "REC UNREAD");
@@ -252,88 +501,433 @@ int A6lib::getSMSLocs(int* buf, int maxItems) {
     return getSMSLocsOfType(buf, maxItems, "ALL");
 }
 
+struct A6smsList {
+    int *locs;
+    SMSrecord *records;
+    int maxItems;
+    int count;
+    // The attempt of the command in flight, and the one being listed, to
+    // start over when the command is sent again.
+    const byte *attempt;
+    byte listedAttempt;
+    // The record that the following body lines belong to, if any.
+    SMSrecord *current;
+    // Whether the lines coming in are a message body.
+    bool inBody;
+    // Whether to turn UCS2 hex into UTF-8.
+    bool decode;
+    // Which listed messages to keep: those with indices from first to last,
+    // or, if wanted isn't NULL, those at its wantedCount indices, each in the
+    // record at the same position, with its result set to A6_OK.
+    int first;
+    int last;
+    const int *wanted;
+    int wantedCount;
+    byte *results;
+};
+
+static void A6beginSMSList(A6smsList *list, int *locs, SMSrecord *records, int maxItems) {
+    list->locs = locs;
+    list->records = records;
+    list->maxItems = maxItems;
+    list->count = 0;
+    list->attempt = NULL;
+    list->listedAttempt = 0;
+    list->current = NULL;
+    list->inBody = false;
+    list->decode = false;
+    list->first = 0;
+    list->last = INT_MAX;
+    list->wanted = NULL;
+    list->wantedCount = 0;
+    list->results = NULL;
+}
+
+// Where to keep the listed message at index, or -1 to skip it.
+static int A6listSlot(A6smsList *list, int index) {
+    if (list->wanted != NULL) {
+        for (int i = 0; i < list->wantedCount; i++) {
+            if (list->wanted[i] == index && list->results[i] != A6_OK) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    if (index < list->first || index > list->last || list->count >= list->maxItems) {
+        return -1;
+    }
+    return list->count;
+}
+
+// Whether the i-th record of a list was filled in.
+static bool A6listed(const A6smsList *list, int i) {
+    return list->wanted != NULL ? list->results[i] == A6_OK : i < list->count;
+}
+
+// Whether a line of a message body, as passed on by messageBodyReceived(), is
+// followed by more of the body.
+static bool A6bodyContinues(const char *line) {
+    size_t len = strlen(line);
+
+    return len > 0 && line[len - 1] == '\n';
+}
+
+// Parse one line of an AT+CMGL listing or an AT+CMGR reply. Headers look like:
+// +CMGL: 1,"REC UNREAD","+1234567890",,"17/01/01,10:00:00+08"
+// +CMGR: "REC UNREAD","+1234567890",,"17/01/01,10:00:00+08"
+// and are followed by the message body.
+static void A6parseSMSListLine(const char *line, void *context) {
+    A6smsList *list = (A6smsList *)context;
+    int index = 0;
+
+    if (list->attempt != NULL && *list->attempt != list->listedAttempt) {
+        // The command was sent again, so whatever came before is stale.
+        list->listedAttempt = *list->attempt;
+        list->count = 0;
+        list->current = NULL;
+        list->inBody = false;
+        for (int i = 0; i < list->wantedCount; i++) {
+            list->results[i] = A6_NOTOK;
+        }
+    }
+
+    if (list->inBody) {
+        // Append to the body of the last message, which may span lines.
+        list->inBody = A6bodyContinues(line);
+        if (list->current != NULL) {
+            char *message = list->current->message;
+            size_t len = strlen(message);
+
+            if (strlen(line) > A6_MESSAGE_SIZE - 1 - len) {
+                list->current->truncated = true;
+            }
+            strncpy(message + len, line, A6_MESSAGE_SIZE - 1 - len);
+            message[A6_MESSAGE_SIZE - 1] = 0;
+        }
+        return;
+    }
+
+    bool listing = A6parse(line, "+CMGL:", A6int(index)) == 1;
+
+    if (listing || strncmp(line, "+CMGR:", 6) == 0) {
+        SMSrecord *sms = NULL;
+
+        list->current = NULL;
+        list->inBody = true;
+
+        int slot = listing ? A6listSlot(list, index) : list->count < list->maxItems ? list->count : -1;
+        if (slot < 0) {
+            return;
+        }
+        if (list->locs != NULL) {
+            list->locs[slot] = index;
+        }
+        if (list->records != NULL) {
+            sms = &list->records[slot];
+        }
+        if (list->results != NULL) {
+            list->results[slot] = A6_OK;
+        }
+        list->count++;
+
+        if (sms != NULL) {
+            // In UCS2 hex, the number takes four times as much room until
+            // it's decoded.
+            char number[A6_NUMBER_SIZE * 4] = "";
+
+            sms->index = index;
+            sms->status[0] = sms->date[0] = sms->message[0] = 0;
+            sms->truncated = false;
+            if (listing) {
+                A6parse(line, "+CMGL:", A6skip(), A6text(sms->status), A6text(number), A6skip(), A6text(sms->date));
+            } else {
+                A6parse(line, "+CMGR:", A6text(sms->status), A6text(number), A6skip(), A6text(sms->date));
+            }
+            if (list->decode) {
+                A6decodeUCS2(number);
+            }
+            strncpy(sms->number, number, A6_NUMBER_SIZE - 1);
+            sms->number[A6_NUMBER_SIZE - 1] = 0;
+            list->current = sms;
+        }
+    }
+}
+
+
+// List the messages of a type, passing the listing to the parser. With
+// keepStatus, the unread messages listed are left unread, if the modem can do
+// that.
+byte A6lib::listSMS(const char *type, A6smsList *list, bool keepStatus) {
+    char command[30];
+
+    snprintf(command, sizeof(command), keepStatus ? "AT+CMGL=\"%s\",1" : "AT+CMGL=\"%s\"", type);
+
+    // Issue the command and parse the listing as it comes in. Without a
+    // fallback, the listing is tried again if it fails.
+    list->attempt = &attempt;
+    list->decode = smsDecoding;
+    byte result = A6command(command, "\xff\r\nOK\r\n", "\r\nOK\r\n", A6_ADAPTIVE, keepStatus ? 1 : 2, NULL, A6parseSMSListLine, list);
+
+    // The bodies can span lines, so they are decoded once they are complete.
+    if (smsDecoding && list->records != NULL) {
+        for (int i = 0; i < list->maxItems; i++) {
+            if (A6listed(list, i)) {
+                A6decodeUCS2(list->records[i].message);
+            }
+        }
+    }
+    return result;
+}
+
+
+// List all the messages without changing their status, for the parser to pick
+// out the ones it wants. Returns A6_NOTOK if the modem can't, and then they
+// have to be read one by one.
+byte A6lib::peekSMS(A6smsList *list) {
+    if (!smsPeeking) {
+        return A6_NOTOK;
+    }
+
+    byte result = listSMS("ALL", list, true);
+    if (result != A6_OK && result != A6_TIMEOUT) {
+        // It doesn't know the mode, so don't ask again.
+        smsPeeking = false;
+    }
+    return result;
+}
+
+
 // Retrieve the number and locations of all SMS messages.
-int A6lib::getSMSLocsOfType(int* buf, int maxItems, String type) {
-    String seqStart = "+CMGL: ";
-    String response = "";
+int A6lib::getSMSLocsOfType(int* buf, int maxItems, const String &type) {
+    return getSMSLocsOfType(buf, maxItems, type.c_str());
+}
 
-    String command = "AT+CMGL=\"";
-    command += type;
-    command += "\"";
 
-    // Issue the command and wait for the response.
-    A6command(command.c_str(), "\xff\r\nOK\r\n", "\r\nOK\r\n", A6_CMD_TIMEOUT, 2, &response);
+int A6lib::getSMSLocsOfType(int* buf, int maxItems, const char *type) {
+    A6smsList list;
+
+    A6beginSMSList(&list, buf, NULL, maxItems);
+    listSMS(type, &list);
+    return list.count;
+}
+
+
+// Read all SMS messages of a type ("REC UNREAD", "REC READ", "ALL", etc) with a
+// single command. Returns how many were read into buf.
+int A6lib::readSMSList(SMSrecord *buf, int maxItems, const String &type) {
+    return readSMSList(buf, maxItems, type.c_str());
+}
+
+
+int A6lib::readSMSList(SMSrecord *buf, int maxItems, const char *type) {
+    A6smsList list;
+
+    A6beginSMSList(&list, NULL, buf, maxItems);
+    listSMS(type, &list);
+    return list.count;
+}
 
-    int seqStartLen = seqStart.length();
-    int responseLen = response.length();
-    int index, occurrences = 0;
 
-    // Start looking for the +CMGL string.
-    for (int i = 0; i < (responseLen - seqStartLen); i++) {
-        // If we found a response and it's less than occurrences, add it.
-        if (response.substring(i, i + seqStartLen) == seqStart && occurrences < maxItems) {
-            // Parse the position out of the reply.
-            sscanf(response.substring(i, i + 12).c_str(), "+CMGL: %u,%*s", &index);
+// Read the messages with indices from first to last (inclusive). Returns how
+// many were read into buf. They are picked out of a single listing that leaves
+// all the messages as they were, so the unread ones stay unread, these
+// included. Modems that can't list like that read each with AT+CMGR instead,
+// which marks it read and costs a round trip per index.
+int A6lib::readSMSRange(int first, int last, SMSrecord *buf, int maxItems) {
+    A6smsList list;
+
+    A6beginSMSList(&list, NULL, buf, maxItems);
+    list.first = first;
+    list.last = last;
+    if (peekSMS(&list) == A6_OK) {
+        return list.count;
+    }
 
-            buf[occurrences] = index;
-            occurrences++;
+    int count = 0;
+    for (int index = first; index <= last && count < maxItems; index++) {
+        if (readSMS(index, &buf[count]) == A6_OK) {
+            count++;
         }
     }
-    return occurrences;
+    return count;
+}
+
+
+// Read the messages at count indices, into the record at the same position in
+// buf. results[i] is set to A6_OK if the message at indices[i] was read, and
+// A6_NOTOK otherwise. Returns how many were read. Like readSMSRange(), this
+// takes a single listing.
+int A6lib::readSMS(const int *indices, int count, SMSrecord *buf, byte *results) {
+    A6smsList list;
+
+    A6beginSMSList(&list, NULL, buf, count);
+    list.wanted = indices;
+    list.wantedCount = count;
+    list.results = results;
+    for (int i = 0; i < count; i++) {
+        results[i] = A6_NOTOK;
+    }
+    if (peekSMS(&list) == A6_OK) {
+        return list.count;
+    }
+
+    int read = 0;
+    for (int i = 0; i < count; i++) {
+        results[i] = readSMS(indices[i], &buf[i]) == A6_OK ? A6_OK : A6_NOTOK;
+        read += results[i] == A6_OK;
+    }
+    return read;
+}
+
+struct A6smsReader {
+    SMSmessage *sms;
+    // Whether the lines coming in are the body.
+    bool inBody;
+};
+
+// Fill in an SMSmessage from an AT+CMGR reply. Unlike an SMSrecord, the body
+// can be as long as it is.
+static void A6parseSMSMessageLine(const char *line, void *context) {
+    A6smsReader *reader = (A6smsReader *)context;
+    SMSmessage *sms = reader->sms;
+    // In UCS2 hex, the number takes four times as much room until it's
+    // decoded.
+    char number[A6_NUMBER_SIZE * 4];
+    char date[A6_DATE_SIZE];
+
+    if (reader->inBody) {
+        sms->message += line;
+        reader->inBody = A6bodyContinues(line);
+    } else if (A6parse(line, "+CMGR:", A6skip(), A6text(number), A6skip(), A6text(date)) == 4) {
+        // Start over if the command was retried.
+        sms->number = number;
+        sms->date = date;
+        sms->message = "";
+        reader->inBody = true;
+    }
+}
+
+
+// Turn a String of UCS2 hex into UTF-8, in place, if it is UCS2 hex.
+static void A6decodeUCS2(String &text) {
+    if (text.length() > 0 && A6decodeUCS2(&text[0])) {
+        text.remove(strlen(text.c_str()));
+    }
 }
 
+
 // Return the SMS at index.
 SMSmessage A6lib::readSMS(int index) {
-    String response = "";
+    // Start with empty Strings, which don't allocate, and fill them in place.
+    SMSmessage sms;
+    A6smsReader reader = { &sms, false };
     char buffer[30];
 
-    // Issue the command and wait for the response.
     sprintf(buffer, "AT+CMGR=%d", index);
-    A6command(buffer, "\xff\r\nOK\r\n", "\r\nOK\r\n", A6_CMD_TIMEOUT, 2, &response);
-
-    char number[50];
-    char date[50];
-    char type[10];
-    int respStart = 0;
-    SMSmessage sms = (const struct SMSmessage) {
-        "", "", ""
-    };
+    A6command(buffer, "\xff\r\nOK\r\n", "\r\nOK\r\n", A6_ADAPTIVE, 2, NULL, A6parseSMSMessageLine, &reader);
 
-    // Parse the response if it contains a valid +CLCC.
-    respStart = response.indexOf("+CMGR");
-    if (respStart >= 0) {
-        // Parse the message header.
-        sscanf(response.substring(respStart).c_str(), "+CMGR: \"REC %s\",\"%s\",,\"%s\"\r\n", type, number, date);
-        sms.number = String(number);
-        sms.date = String(date);
-        // The rest is the message, extract it.
-        sms.message = response.substring(strlen(type) + strlen(number) + strlen(date) + 24, response.length() - 8);
+    if (smsDecoding) {
+        A6decodeUCS2(sms.number);
+        A6decodeUCS2(sms.message);
     }
     return sms;
 }
 
+
+// Read the SMS at index into sms.
+byte A6lib::readSMS(int index, SMSrecord *sms) {
+    A6smsList list;
+    char buffer[30];
+
+    A6beginSMSList(&list, NULL, sms, 1);
+    list.attempt = &attempt;
+    list.decode = smsDecoding;
+
+    // Issue the command and parse the reply as it comes in.
+    sprintf(buffer, "AT+CMGR=%d", index);
+    A6command(buffer, "\xff\r\nOK\r\n", "\r\nOK\r\n", A6_ADAPTIVE, 2, NULL, A6parseSMSListLine, &list);
+
+    if (list.count == 0) {
+        return A6_NOTOK;
+    }
+    sms->index = index;
+    if (smsDecoding) {
+        A6decodeUCS2(sms->message);
+    }
+    return A6_OK;
+}
+
 // Delete the SMS at index.
 byte A6lib::deleteSMS(int index) {
     char buffer[20];
     sprintf(buffer, "AT+CMGD=%d", index);
-    return A6command(buffer, "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+    return A6command(buffer, "OK", "yy", A6_ADAPTIVE, 2, NULL);
 }
 
 // Delete SMS with special flags; example 1,4 delete all SMS from the storage area
 byte A6lib::deleteSMS(int index, int flag) {
-    String command = "AT+CMGD=";
-    command += String(index);
-    command += ",";
-    command += String(flag);
-    return A6command(command.c_str(), "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+    char buffer[20];
+    sprintf(buffer, "AT+CMGD=%d,%d", index, flag);
+    return A6command(buffer, "OK", "yy", A6_ADAPTIVE, 2, NULL);
+}
+
+
+// Delete all the messages of a type ("REC READ", "ALL", etc), storing the
+// indices of the ones that were deleted in deleted. At most maxItems are
+// deleted, call this again if it returns maxItems. Returns how many were
+// deleted.
+int A6lib::deleteSMSOfType(const char *type, int *deleted, int maxItems) {
+    // AT+CMGD can delete the read messages in one go. It can delete all of
+    // them too, but that would take any that arrived after the listing with
+    // them.
+    int flag = strcmp(type, "REC READ") == 0 ? 1 : 0;
+
+    // List them first, so we know which ones were deleted. If there are more
+    // than fit, only delete the ones listed.
+    int count = getSMSLocsOfType(deleted, maxItems, type);
+    if (flag != 0 && count < maxItems && deleteSMS(1, flag) == A6_OK) {
+        return count;
+    }
+
+    // Delete them one by one, keeping the ones that were deleted.
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (deleteSMS(deleted[i]) == A6_OK) {
+            deleted[kept++] = deleted[i];
+        }
+    }
+    return kept;
 }
 
 // Set the SMS charset.
-byte A6lib::setSMScharset(String charset) {
+byte A6lib::setSMScharset(const String &charset) {
+    return setSMScharset(charset.c_str());
+}
+
+
+byte A6lib::setSMScharset(const char *charset) {
     char buffer[30];
 
-    sprintf(buffer, "AT+CSCS=\"%s\"", charset.c_str());
-    return A6command(buffer, "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+    snprintf(buffer, sizeof(buffer), "AT+CSCS=\"%s\"", charset);
+    return A6command(buffer, "OK", "yy", A6_ADAPTIVE, 2, NULL);
+}
+
+
+// Turn decoding of read messages on or off. With it on, the number and text
+// of messages are turned from UCS2 hex (which begin() sets the modem up to
+// send) into UTF-8, in place, as they are read. Sending always takes UTF-8.
+void A6lib::enableSMSDecoding(byte enable) {
+    smsDecoding = enable;
+}
+
+
+// Turn new SMS indications (+CMTI) on or off. With them on, register a "+CMTI:"
+// handler with onUnsolicited() instead of polling for unread messages.
+byte A6lib::enableSMSNotifications(byte enable) {
+    if (enable) {
+        return A6command("AT+CNMI=2,1", "OK", "yy", A6_ADAPTIVE, 2, NULL);
+    }
+    return A6command("AT+CNMI=1,0", "OK", "yy", A6_ADAPTIVE, 2, NULL);
 }
 
 
@@ -345,7 +939,7 @@ void A6lib::setVol(byte level) {
     // level should be between 5 and 8.
     level = min(max(level, 5), 8);
     sprintf(buffer, "AT+CLVL=%d", level);
-    A6command(buffer, "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+    A6command(buffer, "OK", "yy", A6_ADAPTIVE, 2, NULL);
 }
 
 
@@ -357,7 +951,7 @@ void A6lib::enableSpeaker(byte enable) {
     // enable should be between 0 and 1.
     enable = min(max(enable, 0), 1);
     sprintf(buffer, "AT+SNFS=%d", enable);
-    A6command(buffer, "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+    A6command(buffer, "OK", "yy", A6_ADAPTIVE, 2, NULL);
 }
 
 
@@ -367,139 +961,1174 @@ void A6lib::enableSpeaker(byte enable) {
 //
 
 
-// Autodetect the connection rate.
+// (Re)start the serial connection at the given rate.
+void A6lib::startSerial(long rate) {
+    beginSerial(A6conn, rate);
+    this->rate = rate;
+}
+
 
-long A6lib::detectRate() {
-    unsigned long rate = 0;
-    unsigned long rates[] = {9600, 115200};
+// Check whether the module answers at the given rate.
+bool A6lib::probeRate(long rate) {
+    startSerial(rate);
+    A6_TRACE(2, A6_TRACE_RATE_TRY, rate);
+
+    // Give the UART a moment to settle. The first AT may only be used by the
+    // module to detect the rate, so it gets a second chance.
+    delay(10);
+    return A6command("\rAT", "OK", "+CME", 200, 2, NULL) == A6_OK;
+}
 
-    // Try to autodetect the rate.
-    logln("Autodetecting connection rate...");
-    for (int i = 0; i < countof(rates); i++) {
-        rate = rates[i];
 
-        A6conn->begin(rate);
-        log("Trying rate ");
-        log(rate);
-        logln("...");
+// Autodetect the connection rate. The last rate that worked (in this session
+// or, if a store was set, a previous one) and the rate we're about to switch to
+// are tried first, then the rest in order of how likely the module is to be
+// using them. Returns 0 if the module didn't answer at any rate.
+long A6lib::detectRate(long preferred) {
+    long rates[] = {0, 0, preferred, 115200, 9600, 57600, 38400, 19200, 4800, 230400};
+
+    rates[0] = knownRate;
+    if (rateLoad != NULL) {
+        rates[1] = rateLoad(rateContext);
+    }
+
+    // Try to autodetect the rate.
+    for (unsigned int i = 0; i < A6countof(rates); i++) {
+        bool tried = rates[i] <= 0;
 
-        delay(100);
-        if (A6command("\rAT", "OK", "+CME", 2000, 2, NULL) == A6_OK) {
-            return rate;
+        for (unsigned int j = 0; j < i && !tried; j++) {
+            tried = rates[j] == rates[i];
+        }
+        if (!tried && probeRate(rates[i])) {
+            knownRate = rates[i];
+            return rates[i];
         }
     }
 
-    logln("Couldn't detect the rate.");
+    A6_TRACE(1, A6_TRACE_RATE_FAILED, 0);
 
-    return A6_NOTOK;
+    return 0;
 }
 
 
 // Set the A6 baud rate.
 char A6lib::setRate(long baudRate) {
-    int rate = 0;
-
-    rate = detectRate();
-    if (rate == A6_NOTOK) {
+    long rate = detectRate(baudRate);
+    if (rate == 0) {
         return A6_NOTOK;
     }
 
-    // The rate is already the desired rate, return.
-    //if (rate == baudRate) return OK;
+    if (rate != baudRate) {
+        // Change the rate to the requested.
+        char buffer[30];
+        sprintf(buffer, "AT+IPR=%ld", baudRate);
+        A6command(buffer, "OK", "yy", A6_CMD_TIMEOUT, 3, NULL);
 
-    logln("Setting baud rate on the module...");
-
-    // Change the rate to the requested.
-    char buffer[30];
-    sprintf(buffer, "AT+IPR=%d", baudRate);
-    A6command(buffer, "OK", "+IPR=", A6_CMD_TIMEOUT, 3, NULL);
+        // Begin the connection again at the requested rate.
+        startSerial(baudRate);
+        knownRate = baudRate;
+        A6_TRACE(2, A6_TRACE_RATE_SET, baudRate);
+    }
 
-    logln("Switching to the new rate...");
-    // Begin the connection again at the requested rate.
-    A6conn->begin(baudRate);
-    logln("Rate set.");
+    if (rateSave != NULL && (rateLoad == NULL || rateLoad(rateContext) != baudRate)) {
+        rateSave(baudRate, rateContext);
+    }
 
     return A6_OK;
 }
 
 
-// Read some data from the A6 in a non-blocking manner.
-String A6lib::read() {
-    String reply = "";
-    if (A6conn->available()) {
-        reply = A6conn->readString();
-    }
+// Read whatever the A6 has sent so far, without blocking. Returns the number of
+// bytes read. Reading stops at the end of the reply to the command in flight.
+int A6lib::readAvailable() {
+    int count = 0;
 
-    // XXX: Replace NULs with \xff so we can match on them.
-    for (int x = 0; x < reply.length(); x++) {
-        if (reply.charAt(x) == 0) {
-            reply.setCharAt(x, 255);
+    while (A6conn->available() > 0 && result == A6_PENDING) {
+        if (rawRemaining > 0) {
+            count += receiveData();
+            continue;
         }
-    }
-    return reply;
-}
-
-
-// Issue a command.
-byte A6lib::A6command(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, String *response) {
-    byte returnValue = A6_NOTOK;
-    byte count = 0;
-
-    // Get rid of any buffered output.
-    A6conn->flush();
-
-    while (count < repetitions && returnValue != A6_OK) {
-        log("Issuing command: ");
-        logln(command);
 
-        A6conn->write(command);
-        A6conn->write('\r');
+        char c = A6conn->read();
 
-        if (A6waitFor(resp1, resp2, timeout, response) == A6_OK) {
-            returnValue = A6_OK;
-        } else {
-            returnValue = A6_NOTOK;
+        // XXX: Replace NULs with \xff so we can match on them.
+        if (c == 0) {
+            c = 255;
         }
+        receiveByte(c);
         count++;
     }
-    return returnValue;
+    if (count > 0) {
+        receivedAt = millis();
+        metrics.bytesReceived += count;
+    }
+    return count;
 }
 
 
-// Wait for responses.
-byte A6lib::A6waitFor(const char *resp1, const char *resp2, int timeout, String *response) {
-    unsigned long entry = millis();
-    String reply = "";
-    byte retVal = 99;
-    do {
-        reply += read();
-#ifdef ESP8266
-        yield();
-#endif
-    } while (((reply.indexOf(resp1) + reply.indexOf(resp2)) == -2) && ((millis() - entry) < timeout));
+// Append a received byte to the reply buffer and split it into lines.
+void A6lib::receiveByte(char c) {
+    if (rxLength >= A6_RX_BUFFER_SIZE - 1 && lineStart > 0) {
+        // The buffer is full, drop the lines we already have to make room.
+        memmove(rxBuffer, rxBuffer + lineStart, rxLength - lineStart);
+        rxLength -= lineStart;
+        lineStart = 0;
+    }
 
-    if (reply != "") {
-        log("Reply in ");
-        log((millis() - entry));
-        log(" ms: ");
-        logln(reply);
+    // If a single line doesn't fit, the rest of it is lost.
+    if (rxLength < A6_RX_BUFFER_SIZE - 1) {
+        rxBuffer[rxLength++] = c;
+        rxBuffer[rxLength] = 0;
+    } else {
+        metrics.bytesDropped++;
     }
 
-    if (response != NULL) {
-        *response = reply;
+    // A message body can contain the response too, so a match that ends in one
+    // doesn't count.
+    if (waiting && (matchers[0].feed(c) | matchers[1].feed(c)) && !inMessageBody) {
+        matched = true;
     }
 
-    if ((millis() - entry) >= timeout) {
-        retVal = A6_TIMEOUT;
-        logln("Timed out.");
-    } else {
-        if (reply.indexOf(resp1) + reply.indexOf(resp2) > -2) {
-            logln("Reply OK.");
-            retVal = A6_OK;
-        } else {
-            logln("Reply NOT OK.");
-            retVal = A6_NOTOK;
+    // Socket data comes as "+CIPRCV:<socket>,<length>,<data>", where the data
+    // can be anything, so once the header is in, hand the data over as it is
+    // instead of splitting it into lines.
+    if (c == ',' && !(waiting && inMessageBody) && strncmp(rxBuffer + lineStart, "+CIPRCV:", 8) == 0) {
+        int socket, length;
+
+        if (A6parse(rxBuffer + lineStart, "+CIPRCV:", A6int(socket), A6int(length)) == 2) {
+            rawSocket = socket;
+            rawRemaining = length;
+            rxLength = lineStart;
+            rxBuffer[rxLength] = 0;
+            return;
         }
     }
-    return retVal;
+
+    if (c == '\n') {
+        lineReceived();
+    }
+}
+
+
+// Strip the CRLF off a received line.
+static void A6terminateLine(char *line, unsigned int length) {
+    while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == '\n')) {
+        length--;
+    }
+    line[length] = 0;
+}
+
+
+// Whether line is a +CREG that says the module is registered on the network,
+// either unsolicited ("+CREG: 1") or in reply to AT+CREG? ("+CREG: 0,1").
+static bool A6registered(const char *line) {
+    int first, second;
+    int fields = A6parse(line, "+CREG:", A6int(first), A6int(second));
+    int status = fields == 2 ? second : first;
+
+    return fields >= 1 && (status == 1 || status == 5);
+}
+
+
+// Called for every complete line the modem sends. The line lives in
+// rxBuffer, from lineStart to rxLength.
+void A6lib::lineReceived() {
+    char *line = rxBuffer + lineStart;
+
+    if (waiting && inMessageBody) {
+        messageBodyReceived(line);
+        return;
+    }
+
+    // Look for the signs that the module has finished booting.
+    if (booting && (strncmp(line, "Call Ready", 10) == 0 || strncmp(line, "+CIEV:", 6) == 0 || A6registered(line))) {
+        bootReady = true;
+    }
+
+    // Unsolicited lines aren't part of any reply, so hand them to their
+    // handler and forget them.
+    if (!(waiting && matched) && (socketLine(line) || dispatchUnsolicited(line, rxLength - lineStart))) {
+        rxLength = lineStart;
+        rxBuffer[rxLength] = 0;
+        return;
+    }
+
+    A6lineCallback lineCallback = waiting ? queue[queueHead].lineCallback : NULL;
+
+    if (waiting && result == A6_PENDING) {
+        if (matched) {
+            // Only finish at the end of the line the response was on, so
+            // callers get all of it.
+            result = A6_OK;
+        } else if (strncmp(line, "ERROR", 5) == 0) {
+            result = A6_NOTOK;
+        } else if (strncmp(line, "+CME ERROR:", 11) == 0) {
+            result = A6_CME_ERROR;
+            lastError = atoi(line + 11);
+        } else if (strncmp(line, "+CMS ERROR:", 11) == 0) {
+            result = A6_CMS_ERROR;
+            lastError = atoi(line + 11);
+        }
+
+        // The lines after a message header are its body.
+        if (result == A6_PENDING && (strncmp(line, "+CMGL:", 6) == 0 || strncmp(line, "+CMGR:", 6) == 0)) {
+            inMessageBody = true;
+        }
+
+        if (lineCallback != NULL && (result == A6_PENDING || result == A6_OK)) {
+            A6terminateLine(line, rxLength - lineStart);
+            passLine(line);
+        }
+    }
+
+    if (!waiting) {
+        // Nobody is waiting for this, so don't keep it around.
+        rxLength = 0;
+        rxBuffer[0] = 0;
+    }
+    lineStart = rxLength;
+}
+
+
+// Called for a line of the body of a listed or read message. The text of a
+// message can be anything, so it isn't checked for errors or unsolicited
+// results. A message with line breaks comes as lines ending in a bare LF, and
+// the body ends with the first line that ends in CRLF. Only the CRLF is
+// stripped before the line is passed on, so the parser can tell the two apart.
+void A6lib::messageBodyReceived(char *line) {
+    unsigned int length = rxLength - lineStart;
+    A6lineCallback lineCallback = queue[queueHead].lineCallback;
+
+    if (length >= 2 && line[length - 2] == '\r') {
+        inMessageBody = false;
+        length -= 2;
+    }
+
+    if (lineCallback != NULL) {
+        line[length] = 0;
+        passLine(line);
+    }
+    lineStart = rxLength;
+}
+
+
+// Hand a reply line to the line callback of the command in flight, instead of
+// keeping it.
+void A6lib::passLine(char *line) {
+    if (!replyStarted && line[0] != 0) {
+        replyStarted = true;
+        replyStartedAt = millis();
+    }
+    queue[queueHead].lineCallback(line, queue[queueHead].context);
+    rxLength = lineStart;
+    rxBuffer[rxLength] = 0;
+}
+
+
+// Move the first command of the highest priority to the head of the queue and
+// send it. The command in flight is never interrupted, so an urgent command
+// waits at most for that one.
+void A6lib::sendNext() {
+    byte next = 0;
+
+    for (byte i = 1; i < queueCount; i++) {
+        if (queue[(queueHead + i) % A6_QUEUE_SIZE].priority < queue[(queueHead + next) % A6_QUEUE_SIZE].priority) {
+            next = i;
+        }
+    }
+    if (next > 0) {
+        A6queuedCommand cmd = queue[(queueHead + next) % A6_QUEUE_SIZE];
+
+        for (byte i = next; i > 0; i--) {
+            queue[(queueHead + i) % A6_QUEUE_SIZE] = queue[(queueHead + i - 1) % A6_QUEUE_SIZE];
+        }
+        queue[queueHead] = cmd;
+    }
+
+    A6queuedCommand *cmd = &queue[queueHead];
+    A6queueStats *queueStats = &metrics.queues[cmd->priority];
+    unsigned long wait = millis() - cmd->queuedAt;
+
+    queueStats->count++;
+    queueStats->totalWait += wait;
+    queueStats->maxWait = max(queueStats->maxWait, wait);
+    sendHead();
+}
+
+
+// Name a command by what follows "AT", up to the first parameter, e.g. "+CMGR"
+// for "AT+CMGR=3". name must have room for A6_COMMAND_NAME_SIZE bytes.
+static void A6commandName(const char *command, char *name) {
+    byte len = 0;
+
+    while (*command == '\r') {
+        command++;
+    }
+    if (strncmp(command, "AT", 2) == 0) {
+        command += 2;
+    }
+    while (command[len] && !strchr("=?;", command[len]) && len < A6_COMMAND_NAME_SIZE - 1) {
+        name[len] = command[len];
+        len++;
+    }
+    name[len] = 0;
+    if (len == 0) {
+        strcpy(name, "AT");
+    }
+}
+
+
+struct A6timeoutProfile {
+    const char *name;
+    // The timeout before the command has been seen to reply, and the range
+    // that adaptive timeouts are kept in, in ms.
+    unsigned int initial;
+    unsigned int minimum;
+    unsigned int maximum;
+};
+
+// Quick queries give up on a lost reply sooner, SMS storage commands are given
+// longer, and everything else starts at A6_CMD_TIMEOUT.
+static const A6timeoutProfile A6timeoutProfiles[] = {
+    { "+CSQ", 1000, 300, 2000 },
+    { "+CLCC", 1000, 300, 2000 },
+    { "+CREG", 1000, 300, 2000 },
+    { "+CPAS", 1000, 300, 2000 },
+    { "+CCLK", 1000, 300, 2000 },
+    { "A", 2000, 500, 5000 },
+    { "H", 2000, 500, 5000 },
+    { "+CHUP", 2000, 500, 5000 },
+    { "+CMGL", 10000, 5000, 30000 },
+    { "+CMGR", 3000, 1000, 10000 },
+    { "+CMGD", 3000, 1000, 10000 },
+    { NULL, A6_CMD_TIMEOUT, 500, 10000 },
+};
+
+
+// The timeout for an attempt at a command: the smoothed reply time plus four
+// times its deviation (RFC 6298), doubled for every repetition, within the
+// range for the command. learned is NULL if the command's reply time isn't
+// learned.
+static unsigned long A6adaptiveTimeout(const char *command, const A6replyTime *learned, byte attempt) {
+    const A6timeoutProfile *profile = A6timeoutProfiles;
+    char name[A6_COMMAND_NAME_SIZE];
+    unsigned long timeout;
+
+    A6commandName(command, name);
+    while (profile->name != NULL && strcmp(profile->name, name) != 0) {
+        profile++;
+    }
+    if (learned == NULL || learned->replies == 0) {
+        timeout = profile->initial;
+    } else {
+        timeout = learned->smoothed + 4 * learned->deviation;
+    }
+    timeout <<= min((int)attempt, 8);
+    return constrain(timeout, profile->minimum, profile->maximum);
+}
+
+
+static void A6learnReplyTime(A6replyTime *learned, unsigned long replyTime) {
+    if (learned->replies++ == 0) {
+        learned->smoothed = replyTime;
+        learned->deviation = replyTime / 2;
+        return;
+    }
+
+    unsigned long deviation = replyTime > learned->smoothed ? replyTime - learned->smoothed : learned->smoothed - replyTime;
+    learned->deviation = (3 * learned->deviation + deviation) / 4;
+    learned->smoothed = (7 * learned->smoothed + replyTime) / 8;
+}
+
+
+// Send the command at the head of the queue to the modem.
+void A6lib::sendHead() {
+    A6queuedCommand *cmd = &queue[queueHead];
+
+    // Get rid of any buffered output, such as the tail of the previous reply.
+    waiting = false;
+    readAvailable();
+    A6conn->flush();
+    rxLength = 0;
+    lineStart = 0;
+    rxBuffer[0] = 0;
+    // Commands with data wait for the prompt first.
+    prompting = cmd->writer != NULL;
+    dataSent = false;
+    replyStarted = false;
+    matchers[0].begin(prompting ? ">" : cmd->resp1);
+    matchers[1].begin(prompting ? "" : cmd->resp2);
+    matched = false;
+    inMessageBody = false;
+    result = A6_PENDING;
+
+    metrics.bytesSent += A6conn->write(cmd->command);
+    metrics.bytesSent += A6conn->write('\r');
+
+    waiting = true;
+    sentAt = millis();
+    if (attempt == 0) {
+        firstSentAt = sentAt;
+        stats = findStats(cmd->command);
+        replyTime = cmd->timeout == A6_ADAPTIVE ? findReplyTime(cmd->command) : NULL;
+    } else if (stats != NULL) {
+        stats->retries++;
+    }
+    attemptTimeout = cmd->timeout != A6_ADAPTIVE ? cmd->timeout : A6adaptiveTimeout(cmd->command, replyTime, attempt);
+    A6_TRACE(3, A6_TRACE_COMMAND, traceName());
+}
+
+
+// The modem has prompted for the data of the command in flight, so write it and
+// wait for the actual reply.
+void A6lib::writeData() {
+    A6queuedCommand *cmd = &queue[queueHead];
+
+    metrics.bytesSent += cmd->writer(*A6conn, cmd->context);
+
+    prompting = false;
+    dataSent = true;
+    matchers[0].begin(cmd->resp1);
+    matchers[1].begin(cmd->resp2);
+    matched = false;
+    sentAt = millis();
+}
+
+
+// Move the command that was queued last to the front of the queue, so it's
+// sent next. Only call this when no command is in flight.
+void A6lib::moveLastToFront() {
+    queueHead = (queueHead + A6_QUEUE_SIZE - 1) % A6_QUEUE_SIZE;
+    queue[queueHead] = queue[(queueHead + queueCount) % A6_QUEUE_SIZE];
+}
+
+
+// Start sending the next queued SMS part, if there is one and its time has
+// come.
+void A6lib::pollSMS() {
+    if (smsBusy) {
+        return;
+    }
+
+    // Stay in PDU mode only if the next part can go out right away. Otherwise
+    // switch back before anything else is sent, since everything else expects
+    // text mode. AT+CMGF is urgent, so it goes first, and if even the last
+    // slot is taken, this is tried again on the next poll.
+    if (pduMode && (queueCount > 0 || smsCount == 0 || (long)(millis() - smsRetryAt) < 0)) {
+        if (submit("AT+CMGF=1", "OK", "yy", A6_ADAPTIVE, 2, NULL, NULL) == A6_OK) {
+            pduMode = false;
+        }
+        return;
+    }
+
+    if (smsCount == 0 || (long)(millis() - smsRetryAt) < 0 || queueCount >= A6_QUEUE_SIZE - 1) {
+        return;
+    }
+
+    if (!smsStarted) {
+        A6outboundSMS *sms = &smsQueue[smsHead];
+
+        smsEncoder.begin(sms->number, sms->text, smsReference++);
+        smsPartLength = smsEncoder.nextPart();
+        smsStarted = true;
+        A6_TRACE(2, A6_TRACE_SEND_SMS, smsEncoder.getParts());
+    }
+
+    if (pduMode) {
+        smsBusy = sendSMSPart() == A6_OK;
+    } else {
+        smsBusy = submit("AT+CMGF=0", "OK", "yy", A6_ADAPTIVE, 1, smsModeSet, this) == A6_OK;
+    }
+}
+
+
+byte A6lib::sendSMSPart() {
+    char buffer[20];
+
+    sprintf(buffer, "AT+CMGS=%d", smsPartLength);
+    return submitData(buffer, writeSMSPart, "OK", "yy", A6_SMS_TIMEOUT, 1, smsPartSent, this);
+}
+
+
+void A6lib::smsModeSet(byte result, const char *response, void *context) {
+    A6lib *self = (A6lib *)context;
+
+    (void)response;
+    if (result != A6_OK) {
+        self->smsPartDone(result, -1);
+        return;
+    }
+
+    self->pduMode = true;
+    if (self->sendSMSPart() == A6_OK) {
+        // Send the part before anything else that was queued in the meantime.
+        self->moveLastToFront();
+    } else {
+        // The queue filled up while the mode was being set. This isn't the
+        // message's fault, so switch back and try again later.
+        self->smsBusy = false;
+        self->pollSMS();
+    }
+}
+
+
+size_t A6lib::writeSMSPart(Print &out, void *context) {
+    A6lib *self = (A6lib *)context;
+
+    return self->smsEncoder.write(out) + out.write(0x1a);
+}
+
+
+// The reply has the message reference on a +CMGS line before the OK.
+void A6lib::smsPartSent(byte result, const char *response, void *context) {
+    const char *line = strstr(response, "+CMGS:");
+    int reference = -1;
+
+    if (result == A6_OK && line != NULL) {
+        A6parse(line, "+CMGS:", A6int(reference));
+    }
+    ((A6lib *)context)->smsPartDone(result, reference);
+}
+
+
+// Move on after a part of the SMS being sent went out, or failed.
+void A6lib::smsPartDone(byte outcome, int reference) {
+    if (outcome == A6_OK) {
+        smsAttempt = 0;
+        smsPartLength = smsEncoder.nextPart();
+        if (smsPartLength == 0) {
+            finishSMS(A6_OK, reference);
+        }
+    } else if (++smsAttempt < A6_SMS_ATTEMPTS) {
+        // Try the same part again later.
+        unsigned long backoff = (unsigned long)A6_SMS_BACKOFF << (smsAttempt - 1);
+
+        A6_TRACE(2, A6_TRACE_SMS_RETRY, backoff);
+        smsRetryAt = millis() + backoff;
+    } else {
+        finishSMS(outcome, -1);
+    }
+    smsBusy = false;
+    pollSMS();
+}
+
+
+// Pop the SMS at the head of the SMS queue and report its result.
+void A6lib::finishSMS(byte outcome, int reference) {
+    A6outboundSMS *sms = &smsQueue[smsHead];
+    A6smsCallback callback = sms->callback;
+    void *context = sms->context;
+
+    smsHead = (smsHead + 1) % A6_SMS_QUEUE_SIZE;
+    smsCount--;
+    smsStarted = false;
+    smsAttempt = 0;
+
+    if (callback != NULL) {
+        callback(outcome, reference, context);
+    }
+}
+
+
+// Pop the command at the head of the queue and report its result.
+void A6lib::finishHead(byte outcome) {
+    A6queuedCommand *cmd = &queue[queueHead];
+    A6commandCallback callback = cmd->callback;
+    void *context = cmd->context;
+    unsigned long latency = millis() - firstSentAt;
+    byte bucket = 0;
+
+    if (stats != NULL) {
+        stats->count++;
+        if (outcome == A6_TIMEOUT) {
+            stats->timeouts++;
+        } else if (outcome != A6_OK) {
+            stats->errors++;
+        }
+        stats->totalLatency += latency;
+        stats->maxLatency = max(stats->maxLatency, latency);
+        for (unsigned long l = latency >> 5; l > 0 && bucket < A6_LATENCY_BUCKETS - 1; l >>= 1) {
+            bucket++;
+        }
+        stats->latency[bucket]++;
+    }
+
+    // Only learn from first attempts, as a reply to a repeated command could
+    // be to any of them. A reply that is passed on line by line can go on for
+    // as long as there is data, so only the wait for its first line counts.
+    if (outcome == A6_OK && attempt == 0 && replyTime != NULL) {
+        A6learnReplyTime(replyTime, (replyStarted ? replyStartedAt : millis()) - sentAt);
+    }
+
+#ifdef ESP8266
+    unsigned long freeHeap = ESP.getFreeHeap();
+    if (metrics.minFreeHeap == 0 || freeHeap < metrics.minFreeHeap) {
+        metrics.minFreeHeap = freeHeap;
+    }
+#endif
+
+    // Free the slot before calling back, so the callback can queue more
+    // commands.
+    queueHead = (queueHead + 1) % A6_QUEUE_SIZE;
+    queueCount--;
+    waiting = false;
+    prompting = false;
+    attempt = 0;
+    result = A6_PENDING;
+
+    if (callback != NULL) {
+        callback(outcome, rxBuffer, context);
+    }
+}
+
+
+// Queue a command to be sent to the modem. This returns immediately, the
+// command is sent and its reply collected by poll(), and callback is called
+// with the result when the command is done. resp1 and resp2 must stay valid
+// until then. The command is done at the end of the line they match, so they
+// have to be final responses such as "OK": anything the modem sends after
+// them is taken as the reply to the next command.
+byte A6lib::submit(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, A6commandCallback callback, void *context) {
+    return submit(command, resp1, resp2, timeout, repetitions, callback, NULL, context);
+}
+
+
+// Queue a command whose reply lines are passed to lineCallback as they arrive,
+// rather than collected for callback. Use this for replies that can be longer
+// than A6_RX_BUFFER_SIZE.
+byte A6lib::submit(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, A6commandCallback callback, A6lineCallback lineCallback, void *context) {
+    return enqueue(command, resp1, resp2, timeout, repetitions, callback, lineCallback, NULL, context);
+}
+
+
+// Queue a command that prompts for data, such as AT+CMGS. Once the modem
+// prompts with "> ", writer is called to write the data, and then the reply is
+// collected as usual. The command isn't repeated once the data has been
+// written, since the modem may have acted on it. context is passed to both
+// writer and callback.
+byte A6lib::submitData(const char *command, A6writeCallback writer, const char *resp1, const char *resp2, int timeout, int repetitions, A6commandCallback callback, void *context) {
+    return enqueue(command, resp1, resp2, timeout, repetitions, callback, NULL, writer, context);
+}
+
+
+static byte A6commandPriority(const char *command) {
+    static const char *const urgent[] = { "A", "H", "H0", "+CHUP", "+CMGF" };
+    static const char *const background[] = { "+CSQ", "+CLCC", "+CREG", "+CPAS" };
+    char name[A6_COMMAND_NAME_SIZE];
+
+    A6commandName(command, name);
+    for (byte i = 0; i < sizeof(urgent) / sizeof(urgent[0]); i++) {
+        if (strcmp(name, urgent[i]) == 0) {
+            return A6_PRIORITY_URGENT;
+        }
+    }
+    for (byte i = 0; i < sizeof(background) / sizeof(background[0]); i++) {
+        if (strcmp(name, background[i]) == 0) {
+            return A6_PRIORITY_BACKGROUND;
+        }
+    }
+    return A6_PRIORITY_NORMAL;
+}
+
+
+byte A6lib::enqueue(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, A6commandCallback callback, A6lineCallback lineCallback, A6writeCallback writer, void *context) {
+    byte priority = A6commandPriority(command);
+    A6queueStats *queueStats = &metrics.queues[priority];
+
+    if (priority == A6_PRIORITY_BACKGROUND) {
+        // If the same poll is still waiting to be sent, its reply will do for
+        // this one too.
+        for (byte i = waiting; i < queueCount; i++) {
+            A6queuedCommand *cmd = &queue[(queueHead + i) % A6_QUEUE_SIZE];
+
+            if (strcmp(cmd->command, command) == 0 && cmd->callback == callback && cmd->lineCallback == lineCallback && cmd->context == context) {
+                queueStats->coalesced++;
+                return A6_OK;
+            }
+        }
+    }
+
+    // Only urgent commands can take the last slot, so there's always room to
+    // answer a call.
+    if (queueCount >= A6_QUEUE_SIZE - (priority != A6_PRIORITY_URGENT) || strlen(command) >= A6_CMD_MAXLEN) {
+        return A6_NOTOK;
+    }
+
+    A6queuedCommand *cmd = &queue[(queueHead + queueCount) % A6_QUEUE_SIZE];
+    strcpy(cmd->command, command);
+    cmd->priority = priority;
+    cmd->queuedAt = millis();
+    cmd->resp1 = resp1;
+    cmd->resp2 = resp2;
+    cmd->timeout = timeout;
+    cmd->repetitions = repetitions;
+    cmd->callback = callback;
+    cmd->lineCallback = lineCallback;
+    cmd->writer = writer;
+    cmd->context = context;
+    queueCount++;
+
+    queueStats->maxDepth = max(queueStats->maxDepth, getQueueDepth(priority));
+    return A6_OK;
+}
+
+
+// Advance the command state machine. This never blocks, so it should be
+// called as often as possible from loop().
+void A6lib::poll() {
+    readAvailable();
+
+    if (waiting && backingOff) {
+        if ((long)(millis() - retryAt) >= 0) {
+            backingOff = false;
+            sendHead();
+        }
+    } else if (waiting) {
+        A6queuedCommand *cmd = &queue[queueHead];
+
+        if (prompting && matched && result == A6_PENDING) {
+            writeData();
+        }
+
+        if (matched && (millis() - receivedAt) >= A6_LINE_GRACE) {
+            result = A6_OK;
+        }
+
+        if (result == A6_OK) {
+            A6_TRACE(3, A6_TRACE_REPLY, millis() - sentAt);
+            finishHead(A6_OK);
+        } else if (result != A6_PENDING || (millis() - (replyStarted ? receivedAt : sentAt)) >= attemptTimeout) {
+            if (result == A6_PENDING) {
+                A6_TRACE(1, A6_TRACE_TIMEOUT, traceName());
+                result = A6_TIMEOUT;
+            } else {
+                A6_TRACE(1, A6_TRACE_REPLY_ERROR, result);
+            }
+
+            if (++attempt < cmd->repetitions && !dataSent && !replyStarted) {
+                unsigned long backoff = (unsigned long)A6_RETRY_BACKOFF << min(attempt - 1, 8);
+
+                backingOff = true;
+                retryAt = millis() + backoff / 2 + random(backoff / 2 + 1);
+            } else {
+                finishHead(result);
+            }
+        }
+    }
+
+    pollSMS();
+
+    if (!waiting && queueCount > 0) {
+        sendNext();
+    }
+}
+
+
+// Call the handler registered for this line, if any. Returns whether the line
+// was unsolicited.
+bool A6lib::dispatchUnsolicited(char *line, unsigned int length) {
+    A6urcHandler *handler = NULL;
+
+    for (byte i = 0; i < urcHandlerCount; i++) {
+        if (strncmp(line, urcHandlers[i].prefix, strlen(urcHandlers[i].prefix)) == 0) {
+            handler = &urcHandlers[i];
+            break;
+        }
+    }
+    if (handler == NULL) {
+        return false;
+    }
+
+    // The reply to a command (e.g. "+CREG: 0,1" to "AT+CREG?") looks just like
+    // the unsolicited version, so leave those to the command in flight.
+    if (waiting && line[0] == '+') {
+        const char *command = queue[queueHead].command + 2;
+        const char *colon = strchr(line, ':');
+        unsigned int nameLen = colon != NULL ? colon - line : length;
+
+        char next = command[nameLen];
+        if (strncmp(command, line, nameLen) == 0 && (next == 0 || next == '=' || next == '?')) {
+            return false;
+        }
+    }
+
+    A6terminateLine(line, length);
+
+    A6_TRACE(3, A6_TRACE_UNSOLICITED, handler - urcHandlers);
+    handler->callback(line, handler->context);
+    return true;
+}
+
+
+// Register a handler for unsolicited lines starting with prefix, such as
+// "RING", "+CLIP:" or "+CMTI:". prefix must stay valid while registered, and
+// only the first matching handler is called. Handlers are called from poll()
+// (or while a blocking command waits), so they should only queue commands with
+// submit(), never issue blocking ones.
+byte A6lib::onUnsolicited(const char *prefix, A6urcCallback callback, void *context) {
+    if (urcHandlerCount >= A6_MAX_URC_HANDLERS) {
+        return A6_NOTOK;
+    }
+
+    urcHandlers[urcHandlerCount].prefix = prefix;
+    urcHandlers[urcHandlerCount].callback = callback;
+    urcHandlers[urcHandlerCount].context = context;
+    urcHandlerCount++;
+    return A6_OK;
+}
+
+
+// Stop handling unsolicited lines starting with prefix.
+void A6lib::removeUnsolicited(const char *prefix) {
+    for (byte i = 0; i < urcHandlerCount; i++) {
+        if (strcmp(urcHandlers[i].prefix, prefix) == 0) {
+            urcHandlerCount--;
+            memmove(&urcHandlers[i], &urcHandlers[i + 1], (urcHandlerCount - i) * sizeof(A6urcHandler));
+            i--;
+        }
+    }
+}
+
+
+// The error code from the last +CME ERROR or +CMS ERROR reply.
+int A6lib::getLastError() {
+    return lastError;
+}
+
+
+// Command statistics and traffic counters since the last resetMetrics().
+const A6metrics &A6lib::getMetrics() {
+    return metrics;
+}
+
+
+void A6lib::resetMetrics() {
+    memset(&metrics, 0, sizeof(metrics));
+    // The command in flight is counted in the new metrics.
+    stats = waiting ? findStats(queue[queueHead].command) : NULL;
+}
+
+
+// Find (or create) the statistics slot for a command, by its name, or NULL if
+// no command statistics are kept.
+A6commandStats *A6lib::findStats(const char *command) {
+#if A6_METRICS_SLOTS > 0
+    char name[A6_COMMAND_NAME_SIZE];
+
+    A6commandName(command, name);
+
+    for (byte i = 0; i < metrics.commandCount; i++) {
+        if (strcmp(metrics.commands[i].name, name) == 0) {
+            return &metrics.commands[i];
+        }
+    }
+
+    // Keep the last slot for everything that doesn't fit.
+    if (metrics.commandCount == A6_METRICS_SLOTS) {
+        return &metrics.commands[A6_METRICS_SLOTS - 1];
+    }
+    if (metrics.commandCount == A6_METRICS_SLOTS - 1) {
+        strcpy(name, "*");
+    }
+
+    A6commandStats *slot = &metrics.commands[metrics.commandCount++];
+    strcpy(slot->name, name);
+    return slot;
+#else
+    return NULL;
+#endif
+}
+
+
+// Find (or create) the learned reply time for a command, by its name, or NULL
+// if there's no room for another one. Sharing a slot would mix up the reply
+// times of different commands.
+A6replyTime *A6lib::findReplyTime(const char *command) {
+    char name[A6_COMMAND_NAME_SIZE];
+
+    A6commandName(command, name);
+
+    for (byte i = 0; i < replyTimeCount; i++) {
+        if (strcmp(replyTimes[i].name, name) == 0) {
+            return &replyTimes[i];
+        }
+    }
+    if (replyTimeCount == A6_REPLY_TIME_SLOTS) {
+        return NULL;
+    }
+
+    A6replyTime *slot = &replyTimes[replyTimeCount++];
+    memset(slot, 0, sizeof(*slot));
+    strcpy(slot->name, name);
+    return slot;
+}
+
+
+#if A6_TRACE_LEVEL > 0
+// Record a trace event. This has to be quick, as it's called while talking to
+// the module.
+void A6lib::trace(A6traceEvent event, long value) {
+    A6traceRecord *record = &traceRecords[(traceHead + traceCount) % A6_TRACE_SIZE];
+
+    if (traceCount < A6_TRACE_SIZE) {
+        traceCount++;
+    } else {
+        traceHead = (traceHead + 1) % A6_TRACE_SIZE;
+    }
+    record->time = millis();
+    record->event = event;
+    record->value = value;
+}
+
+
+// The position of the name of the command in flight in traceNames, adding it
+// if it isn't there. The last slot is shared by all the commands that don't
+// fit.
+long A6lib::traceName() {
+    char name[A6_COMMAND_NAME_SIZE];
+
+    A6commandName(queue[queueHead].command, name);
+
+    for (byte i = 0; i < traceNameCount; i++) {
+        if (strcmp(traceNames[i], name) == 0) {
+            return i;
+        }
+    }
+    if (traceNameCount == A6_TRACE_NAME_SLOTS) {
+        return A6_TRACE_NAME_SLOTS - 1;
+    }
+    if (traceNameCount == A6_TRACE_NAME_SLOTS - 1) {
+        strcpy(name, "*");
+    }
+    strcpy(traceNames[traceNameCount], name);
+    return traceNameCount++;
+}
+#endif
+
+
+// Print and forget the trace records collected so far. Call this when the
+// module isn't busy, e.g. from loop(), as printing can take a while.
+void A6lib::printTrace(Print &out) {
+#if A6_TRACE_LEVEL > 0
+    static const char *const names[] = {
+        "timed out waiting for the module",
+        "couldn't detect the rate",
+        "timed out",
+        "reply not OK",
+        "waiting for the module to be ready",
+        "power-cycling the module",
+        "module ready (ms)",
+        "dialing (digits)",
+        "redialing",
+        "sending SMS (parts)",
+        "retrying SMS in (ms)",
+        "trying rate",
+        "rate set",
+        "issuing command",
+        "reply (ms)",
+        "unsolicited line for handler",
+    };
+
+    while (traceCount > 0) {
+        A6traceRecord *record = &traceRecords[traceHead];
+
+        out.print(record->time);
+        out.print(" ms: ");
+        out.print(names[record->event]);
+        out.print(' ');
+        if (record->event == A6_TRACE_COMMAND || record->event == A6_TRACE_TIMEOUT) {
+            out.println(traceNames[record->value]);
+        } else {
+            out.println(record->value);
+        }
+
+        traceHead = (traceHead + 1) % A6_TRACE_SIZE;
+        traceCount--;
+    }
+#else
+    (void)out;
+#endif
+}
+
+
+// Whether there are commands queued or in flight.
+bool A6lib::busy() {
+    return queueCount > 0;
+}
+
+
+// How many commands of a priority are queued or in flight.
+byte A6lib::getQueueDepth(byte priority) {
+    byte depth = 0;
+
+    for (byte i = 0; i < queueCount; i++) {
+        depth += queue[(queueHead + i) % A6_QUEUE_SIZE].priority == priority;
+    }
+    return depth;
+}
+
+
+void A6matcher::begin(const char *pattern) {
+    this->pattern = pattern;
+    length = min(strlen(pattern), (size_t)A6_PATTERN_MAXLEN);
+    matched = 0;
+
+    // Work out, for every prefix of the pattern, the longest proper prefix
+    // that is also a suffix of it.
+    byte k = 0;
+    if (length > 0) {
+        fallback[0] = 0;
+    }
+    for (byte i = 1; i < length; i++) {
+        while (k > 0 && pattern[i] != pattern[k]) {
+            k = fallback[k - 1];
+        }
+        if (pattern[i] == pattern[k]) {
+            k++;
+        }
+        fallback[i] = k;
+    }
+}
+
+
+// Feed the next byte of the stream, returns true when it completes a match.
+bool A6matcher::feed(char c) {
+    if (length == 0) {
+        return false;
+    }
+
+    while (matched > 0 && c != pattern[matched]) {
+        matched = fallback[matched - 1];
+    }
+    if (c == pattern[matched]) {
+        matched++;
+    }
+    if (matched == length) {
+        matched = fallback[length - 1];
+        return true;
+    }
+    return false;
+}
+
+
+struct A6commandStatus {
+    bool done;
+    byte result;
+    String *response;
+    A6lineCallback lineCallback;
+    void *lineContext;
+    A6writeCallback writer;
+    void *writerContext;
+};
+
+static void A6commandDone(byte result, const char *response, void *context) {
+    A6commandStatus *status = (A6commandStatus *)context;
+
+    status->done = true;
+    status->result = result;
+    if (status->response != NULL) {
+        *status->response = response;
+    }
+}
+
+
+static void A6commandLine(const char *line, void *context) {
+    A6commandStatus *status = (A6commandStatus *)context;
+
+    status->lineCallback(line, status->lineContext);
+}
+
+
+static size_t A6commandWrite(Print &out, void *context) {
+    A6commandStatus *status = (A6commandStatus *)context;
+
+    return status->writer(out, status->writerContext);
+}
+
+
+// Issue several commands that reply with just OK, concatenated into as few
+// command lines as possible, and block until they complete. Every command must
+// start with "AT". results[i] is set to the result of commands[i]; if a line
+// fails, its commands are retried one by one to find out which one failed.
+byte A6lib::runBatch(const char *const *commands, int count, byte *results) {
+    char line[A6_CMD_MAXLEN];
+    byte returnValue = A6_OK;
+    int first = 0;
+
+    while (first < count) {
+        size_t len = 2;
+        int last = first;
+
+        // Fit as many commands as possible on the line. Extended (+) commands
+        // need to be followed by a semicolon, basic ones don't.
+        strcpy(line, "AT");
+        while (last < count) {
+            const char *command = commands[last] + 2;
+            bool separator = last > first && commands[last - 1][2] == '+';
+
+            if (len + separator + strlen(command) >= sizeof(line)) {
+                break;
+            }
+            if (separator) {
+                line[len++] = ';';
+            }
+            strcpy(line + len, command);
+            len += strlen(command);
+            last++;
+        }
+
+        if (last == first) {
+            // This one doesn't fit on a line by itself.
+            results[first] = A6_NOTOK;
+            returnValue = A6_NOTOK;
+            first++;
+            continue;
+        }
+
+        // Only try a line of several commands once, the fallback below
+        // retries them anyway.
+        byte lineResult = A6command(line, "OK", "yy", A6_CMD_TIMEOUT, last - first == 1 ? 2 : 1, NULL);
+        for (int i = first; i < last; i++) {
+            if (lineResult == A6_OK || last - first == 1) {
+                results[i] = lineResult;
+            } else {
+                results[i] = A6command(commands[i], "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+            }
+            if (results[i] != A6_OK) {
+                returnValue = A6_NOTOK;
+            }
+        }
+        first = last;
+    }
+    return returnValue;
+}
+
+
+// Issue a command and block until it completes. If lineCallback is given, the
+// reply is passed to it line by line instead of being stored in response. If
+// writer is given, it writes the command's data once the modem prompts for it.
+byte A6lib::A6command(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, String *response, A6lineCallback lineCallback, void *lineContext, A6writeCallback writer, void *writerContext) {
+    A6commandStatus status = { false, A6_NOTOK, response, lineCallback, lineContext, writer, writerContext };
+    byte room = A6_QUEUE_SIZE - (A6commandPriority(command) != A6_PRIORITY_URGENT);
+
+    // Wait for room in the queue if asynchronous commands are pending.
+    while (queueCount >= room) {
+        poll();
+#ifdef ESP8266
+        yield();
+#endif
+    }
+
+    if (enqueue(command, resp1, resp2, timeout, repetitions, A6commandDone, lineCallback != NULL ? A6commandLine : NULL, writer != NULL ? A6commandWrite : NULL, &status) != A6_OK) {
+        return A6_NOTOK;
+    }
+
+    while (!status.done) {
+        poll();
+#ifdef ESP8266
+        yield();
+#endif
+    }
+
+    return status.result == A6_OK ? A6_OK : A6_NOTOK;
 }
@@ -2,24 +2,161 @@
 #define A6lib_h
 
 #include <Arduino.h>
+// Define A6_NO_SOFTWARE_SERIAL when building for a platform without
+// SoftwareSerial (e.g. a host build against a fake Stream); the module then has
+// to be passed in as a Stream.
+#ifndef A6_NO_SOFTWARE_SERIAL
 #include "SoftwareSerial.h"
+#endif
+#include "A6codec.h"
 
-#ifdef DEBUG
-#define log(msg) Serial.print(msg)
-#define logln(msg) Serial.println(msg)
-#else
-#define log(msg)
-#define logln(msg)
+// The buffer and table sizes below can be changed with build flags (e.g.
+// -DA6_RX_BUFFER_SIZE=512), so that the library and the sketch agree on them.
+// AVR boards have only 2 KB of RAM in all, so they get smaller defaults.
+
+// How much to trace: 0 for nothing (the tracing code isn't even compiled in),
+// 1 for errors, 2 for what the module is doing and 3 for every command. Set it
+// with a build flag (e.g. -DA6_TRACE_LEVEL=2), so that the library and the
+// sketch agree on it. It doesn't follow DEBUG, which a sketch can define
+// without the library seeing it, leaving them with different members.
+#ifndef A6_TRACE_LEVEL
+#define A6_TRACE_LEVEL 0
 #endif
 
-#define countof(a) (sizeof(a) / sizeof(a[0]))
+// How many trace records are kept until printTrace() is called. Older ones are
+// overwritten.
+#ifndef A6_TRACE_SIZE
+#define A6_TRACE_SIZE 32
+#endif
+// How many different command names the trace keeps. Commands beyond that are
+// printed as "*".
+#ifndef A6_TRACE_NAME_SLOTS
+#define A6_TRACE_NAME_SLOTS 8
+#endif
 
 #define A6_OK 0
 #define A6_NOTOK 1
 #define A6_TIMEOUT 2
 #define A6_FAILURE 3
+// The modem replied with +CME ERROR or +CMS ERROR, see getLastError().
+#define A6_CME_ERROR 4
+#define A6_CMS_ERROR 5
+// The command hasn't finished yet.
+#define A6_PENDING 99
 
 #define A6_CMD_TIMEOUT 2000
+// Pass as the timeout to have it worked out from how long the command has
+// taken before, doubling with every repetition.
+#define A6_ADAPTIVE 0
+// How long to wait before repeating a command, doubling with every repetition,
+// give or take half of it so retries don't fall into step with the module.
+#define A6_RETRY_BACKOFF 100
+// How long to wait for the network to accept an SMS.
+#define A6_SMS_TIMEOUT 15000
+// How many SMS can be waiting to be sent, how many times sending one is
+// attempted, and how long to wait before the first retry (doubling every
+// time).
+#ifndef A6_SMS_QUEUE_SIZE
+#ifdef __AVR__
+#define A6_SMS_QUEUE_SIZE 2
+#else
+#define A6_SMS_QUEUE_SIZE 8
+#endif
+#endif
+#define A6_SMS_ATTEMPTS 3
+#define A6_SMS_BACKOFF 2000
+
+// How long to keep the module off when power-cycling it, and how long to wait
+// for it to become ready afterwards, at most.
+#define A6_POWER_OFF_TIME 2000
+#define A6_BOOT_TIMEOUT 20000
+
+// How many asynchronous commands can be waiting to be sent to the modem. The
+// last slot is kept for urgent commands.
+#ifndef A6_QUEUE_SIZE
+#ifdef __AVR__
+#define A6_QUEUE_SIZE 3
+#else
+#define A6_QUEUE_SIZE 5
+#endif
+#endif
+// Queued commands are sent by priority, and in order within a priority. Call
+// control (ATA, ATH) and switching the SMS mode (AT+CMGF) are urgent, so they
+// go out as soon as the command in flight is done, and background polls
+// (AT+CSQ, AT+CLCC, ...) wait until nothing else is queued.
+#define A6_PRIORITY_URGENT 0
+#define A6_PRIORITY_NORMAL 1
+#define A6_PRIORITY_BACKGROUND 2
+#define A6_PRIORITIES 3
+// The longest command line (without the trailing CR) that can be queued.
+#define A6_CMD_MAXLEN 64
+// How much of a reply is kept in memory. When a reply grows past this, the
+// oldest complete lines are dropped to make room.
+#ifndef A6_RX_BUFFER_SIZE
+#ifdef __AVR__
+#define A6_RX_BUFFER_SIZE 192
+#else
+#define A6_RX_BUFFER_SIZE 1024
+#endif
+#endif
+
+// How many TCP connections can be open at once, and how long to wait for one
+// to connect, or for the data sent over it to be accepted.
+#ifndef A6_MAX_SOCKETS
+#ifdef __AVR__
+#define A6_MAX_SOCKETS 1
+#else
+#define A6_MAX_SOCKETS 4
+#endif
+#endif
+#define A6_CONNECT_TIMEOUT 20000
+#define A6_SEND_TIMEOUT 10000
+// How much received socket data is handed over at a time.
+#define A6_SOCKET_CHUNK 64
+
+// After an expected response is seen, how long to wait for the rest of its
+// line before considering the reply complete anyway (e.g. for the "> "
+// prompt, which isn't followed by a newline).
+#define A6_LINE_GRACE 50
+
+// How many unsolicited result code handlers can be registered.
+#ifndef A6_MAX_URC_HANDLERS
+#ifdef __AVR__
+#define A6_MAX_URC_HANDLERS 4
+#else
+#define A6_MAX_URC_HANDLERS 8
+#endif
+#endif
+
+// The longest expected response that can be matched. Longer ones are cut off.
+#define A6_PATTERN_MAXLEN 24
+
+// How many different commands get their own statistics. Commands beyond that
+// are counted together in the last slot, named "*". With 0, which is the
+// default on AVR, no command statistics are kept at all.
+#ifndef A6_METRICS_SLOTS
+#ifdef __AVR__
+#define A6_METRICS_SLOTS 0
+#else
+#define A6_METRICS_SLOTS 12
+#endif
+#endif
+#define A6_COMMAND_NAME_SIZE 10
+// How many different commands have their reply times learned, for adaptive
+// timeouts. Commands beyond that always get the initial timeout for their kind.
+#ifndef A6_REPLY_TIME_SLOTS
+#ifdef __AVR__
+#define A6_REPLY_TIME_SLOTS 6
+#else
+#define A6_REPLY_TIME_SLOTS 12
+#endif
+#endif
+#define A6_LATENCY_BUCKETS 8
+
+// Called when an asynchronous command completes. result is one of A6_OK,
+// A6_NOTOK (the modem said ERROR), A6_CME_ERROR, A6_CMS_ERROR or A6_TIMEOUT,
+// response is everything the modem replied with.
+typedef void (*A6commandCallback)(byte result, const char *response, void *context);
 
 
 enum call_direction {
@@ -50,12 +187,232 @@ enum call_mode {
     MODE_UNKNOWN = 9
 };
 
+// SMSmessage and callInfo are returned by value. They have no copy
+// constructors of their own, so with a C++11 compiler their Strings are moved
+// out rather than copied.
 struct SMSmessage {
     String number;
     String date;
     String message;
 };
 
+#define A6_STATUS_SIZE 12
+#define A6_NUMBER_SIZE 24
+#define A6_DATE_SIZE 24
+// Big enough for a whole single-part message in UCS2 hex: 160 characters of
+// four hex digits each. On AVR, only for one in plain text.
+#ifndef A6_MESSAGE_SIZE
+#ifdef __AVR__
+#define A6_MESSAGE_SIZE 161
+#else
+#define A6_MESSAGE_SIZE 641
+#endif
+#endif
+
+// An SMS message that lives in fixed-size buffers, so reading one doesn't
+// allocate. Longer fields are truncated.
+struct SMSrecord {
+    int index;
+    char status[A6_STATUS_SIZE];
+    char number[A6_NUMBER_SIZE];
+    char date[A6_DATE_SIZE];
+    char message[A6_MESSAGE_SIZE];
+    // Set if the message didn't fit in message.
+    bool truncated;
+};
+
+// Starts (or restarts) the serial connection to the module at a baud rate.
+typedef void (*A6beginCallback)(Stream *serial, long rate);
+
+template <class T> void A6beginSerial(Stream *serial, long rate) {
+    static_cast<T *>(serial)->begin(rate);
+}
+
+// Load and save the last baud rate the module was known to work at, e.g. from
+// EEPROM, so it can be tried first next time. load should return 0 if nothing
+// was saved.
+typedef long (*A6rateLoad)(void *context);
+typedef void (*A6rateSave)(long rate, void *context);
+
+// Called for every line of a command's reply, for commands whose reply is too
+// long to keep in memory. line doesn't include the trailing CRLF.
+typedef void (*A6lineCallback)(const char *line, void *context);
+
+// Called for every unsolicited line (e.g. "RING" or "+CMTI: \"ME\",3") the
+// modem sends that starts with the prefix the handler was registered for. line
+// doesn't include the trailing CRLF.
+typedef void (*A6urcCallback)(const char *line, void *context);
+
+// Called to write the data for a command that prompts for it with "> " (e.g.
+// the message for AT+CMGS), straight to the modem. Returns the number of bytes
+// written.
+typedef size_t (*A6writeCallback)(Print &out, void *context);
+
+// Called when a queued SMS has been sent, or has failed for the last time.
+// result is A6_OK, A6_NOTOK, A6_CMS_ERROR or A6_TIMEOUT, and reference is the
+// message reference the network gave it (the last part's, for a concatenated
+// SMS), or -1 if it failed.
+typedef void (*A6smsCallback)(byte result, int reference, void *context);
+
+// Called with data received over a socket, as it comes in, or with a length of
+// 0 when the other end closes the connection.
+typedef void (*A6socketCallback)(byte socket, const byte *data, size_t length, void *context);
+
+// Statistics for one connection since it was opened. Dividing the bytes by the
+// time since openedAt gives the throughput.
+struct A6socketStats {
+    unsigned long openedAt;
+    unsigned long bytesSent;
+    unsigned long bytesReceived;
+    unsigned long sends;
+    unsigned long failedSends;
+    // How long sends took, from issuing AT+CIPSEND to SEND OK, in ms.
+    unsigned long totalSendLatency;
+    unsigned long maxSendLatency;
+};
+
+struct A6socket {
+    bool open;
+    A6socketCallback callback;
+    void *context;
+    A6socketStats stats;
+};
+
+struct A6outboundSMS {
+    const char *number;
+    const char *text;
+    A6smsCallback callback;
+    void *context;
+};
+
+struct A6urcHandler {
+    const char *prefix;
+    A6urcCallback callback;
+    void *context;
+};
+
+struct A6smsList;
+
+struct A6queuedCommand {
+    char command[A6_CMD_MAXLEN];
+    byte priority;
+    unsigned long queuedAt;
+    const char *resp1;
+    const char *resp2;
+    int timeout;
+    byte repetitions;
+    A6commandCallback callback;
+    A6lineCallback lineCallback;
+    A6writeCallback writer;
+    void *context;
+};
+
+// Finds a pattern in a stream of bytes, looking at every byte only once
+// (Knuth-Morris-Pratt).
+class A6matcher {
+public:
+    void begin(const char *pattern);
+    bool feed(char c);
+private:
+    const char *pattern;
+    byte length;
+    byte matched;
+    // fallback[i] is how much of the pattern is still matched after a
+    // mismatch at position i.
+    byte fallback[A6_PATTERN_MAXLEN];
+};
+
+enum A6traceEvent {
+    A6_TRACE_BOOT_TIMEOUT,
+    A6_TRACE_RATE_FAILED,
+    A6_TRACE_TIMEOUT,
+    A6_TRACE_REPLY_ERROR,
+    A6_TRACE_NOT_READY,
+    A6_TRACE_POWER_CYCLE,
+    A6_TRACE_BOOT_READY,
+    A6_TRACE_DIAL,
+    A6_TRACE_REDIAL,
+    A6_TRACE_SEND_SMS,
+    A6_TRACE_SMS_RETRY,
+    A6_TRACE_RATE_TRY,
+    A6_TRACE_RATE_SET,
+    A6_TRACE_COMMAND,
+    A6_TRACE_REPLY,
+    A6_TRACE_UNSOLICITED
+};
+
+// A trace record is just numbers, so recording one is cheap; they are only
+// turned into text by printTrace().
+struct A6traceRecord {
+    unsigned long time;
+    long value;
+    byte event;
+};
+
+// Statistics for one command, e.g. "+CSQ" for AT+CSQ.
+struct A6commandStats {
+    char name[A6_COMMAND_NAME_SIZE];
+    unsigned long count;
+    unsigned long retries;
+    unsigned long timeouts;
+    // Replies with ERROR, +CME ERROR or +CMS ERROR.
+    unsigned long errors;
+    // How long the commands took from first sending to completion, including
+    // retries, in ms. latency[i] counts the ones that took less than
+    // 32 << i ms, and the last bucket counts all the slower ones.
+    unsigned long totalLatency;
+    unsigned long maxLatency;
+    unsigned long latency[A6_LATENCY_BUCKETS];
+};
+
+// How many first attempts at a command were answered, and their smoothed reply
+// time and its mean deviation, in ms, which adaptive timeouts are worked out
+// from (as TCP does). Unlike the metrics, these aren't reset.
+struct A6replyTime {
+    char name[A6_COMMAND_NAME_SIZE];
+    unsigned long replies;
+    unsigned long smoothed;
+    unsigned long deviation;
+};
+
+// Statistics for the commands of one priority.
+struct A6queueStats {
+    unsigned long count;
+    // Background commands dropped because the same one was already queued.
+    unsigned long coalesced;
+    byte maxDepth;
+    // How long the commands waited in the queue before being sent, in ms.
+    unsigned long totalWait;
+    unsigned long maxWait;
+};
+
+struct A6metrics {
+#if A6_METRICS_SLOTS > 0
+    A6commandStats commands[A6_METRICS_SLOTS];
+#endif
+    byte commandCount;
+    A6queueStats queues[A6_PRIORITIES];
+    unsigned long bytesSent;
+    unsigned long bytesReceived;
+    // Bytes dropped because a reply line didn't fit in the receive buffer.
+    unsigned long bytesDropped;
+    // The least free heap seen after a command, where the platform can tell
+    // (0 otherwise).
+    unsigned long minFreeHeap;
+};
+
+// The same as callInfo, but in fixed-size buffers, so checking the call
+// doesn't allocate.
+struct callRecord {
+    int index;
+    call_direction direction;
+    call_state state;
+    call_mode mode;
+    int multiparty;
+    char number[A6_NUMBER_SIZE];
+    int type;
+};
+
 struct callInfo {
     int index;
     call_direction direction;
@@ -69,43 +426,235 @@ struct callInfo {
 
 class A6lib {
 public:
+#ifndef A6_NO_SOFTWARE_SERIAL
     A6lib(int transmitPin, int receivePin);
+#endif
+    // Talk to the module over any serial connection that has a begin(rate)
+    // method, e.g. a HardwareSerial.
+    template <class T> A6lib(T &serial) {
+#ifndef A6_NO_SOFTWARE_SERIAL
+        softwareSerial = NULL;
+#endif
+        init(&serial, A6beginSerial<T>);
+    }
     ~A6lib();
 
     byte begin(long baudRate);
     byte blockUntilReady(long baudRate);
 
-    void powerCycle(int pin);
+    byte powerCycle(int pin, unsigned long timeout = A6_BOOT_TIMEOUT);
     void powerOn(int pin);
     void powerOff(int pin);
+    byte waitUntilReady(unsigned long timeout);
+    void setRateStore(A6rateLoad load, A6rateSave save, void *context);
+    unsigned long getBootLatency();
 
-    void dial(String number);
+    void dial(const String &number);
+    void dial(const char *number);
     void redial();
     void answer();
     void hangUp();
     callInfo checkCallStatus();
+    byte checkCallStatus(callRecord *call);
     int getSignalStrength();
 
-    byte sendSMS(String number, String text);
+    byte sendSMS(const String &number, const String &text);
+    byte sendSMS(const char *number, const char *text);
+    byte queueSMS(const char *number, const char *text, A6smsCallback callback, void *context);
+    byte getQueuedSMSCount();
     int getUnreadSMSLocs(int* buf, int maxItems);
     int getSMSLocs(int* buf, int maxItems);
-    int getSMSLocsOfType(int* buf, int maxItems, String type);
+    int getSMSLocsOfType(int* buf, int maxItems, const String &type);
+    int getSMSLocsOfType(int* buf, int maxItems, const char *type);
+    int readSMSList(SMSrecord *buf, int maxItems, const String &type);
+    int readSMSList(SMSrecord *buf, int maxItems, const char *type);
+    int readSMSRange(int first, int last, SMSrecord *buf, int maxItems);
+    int readSMS(const int *indices, int count, SMSrecord *buf, byte *results);
     SMSmessage readSMS(int index);
+    byte readSMS(int index, SMSrecord *sms);
     byte deleteSMS(int index);
     byte deleteSMS(int index, int flag);
-    byte setSMScharset(String charset);
+    int deleteSMSOfType(const char *type, int *deleted, int maxItems);
+    byte setSMScharset(const String &charset);
+    byte setSMScharset(const char *charset);
+    byte enableSMSNotifications(byte enable);
+    void enableSMSDecoding(byte enable);
+
+    byte connectGPRS(const char *apn);
+    byte disconnectGPRS();
+    int openSocket(const char *host, int port, A6socketCallback callback, void *context);
+    byte sendSocket(byte socket, const byte *data, size_t length);
+    byte sendSocket(byte socket, size_t length, A6writeCallback writer, void *context);
+    byte closeSocket(byte socket);
+    const A6socketStats &getSocketStats(byte socket);
 
     void setVol(byte level);
     void enableSpeaker(byte enable);
 
     String getRealTimeClock();
+    byte getRealTimeClock(char *time, size_t size);
+    int getLastError();
+    const A6metrics &getMetrics();
+    void resetMetrics();
+    void printTrace(Print &out);
 
-    SoftwareSerial *A6conn;
+    byte submit(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, A6commandCallback callback, void *context);
+    byte submit(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, A6commandCallback callback, A6lineCallback lineCallback, void *context);
+    byte submitData(const char *command, A6writeCallback writer, const char *resp1, const char *resp2, int timeout, int repetitions, A6commandCallback callback, void *context);
+    void poll();
+    bool busy();
+    byte getQueueDepth(byte priority);
+    byte runBatch(const char *const *commands, int count, byte *results);
+
+    byte onUnsolicited(const char *prefix, A6urcCallback callback, void *context);
+    void removeUnsolicited(const char *prefix);
+
+    Stream *A6conn;
 private:
-    String read();
-    byte A6command(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, String *response);
-    byte A6waitFor(const char *resp1, const char *resp2, int timeout, String *response);
-    long detectRate();
+#ifndef A6_NO_SOFTWARE_SERIAL
+    // Set if we created the connection ourselves.
+    SoftwareSerial *softwareSerial;
+#endif
+    A6beginCallback beginSerial;
+
+    A6queuedCommand queue[A6_QUEUE_SIZE];
+    byte queueHead;
+    byte queueCount;
+    // Whether the command at the head of the queue has been sent and we are
+    // waiting for its reply.
+    bool waiting;
+    byte attempt;
+    unsigned long sentAt;
+    unsigned long firstSentAt;
+    // How long to wait for the reply to this attempt, and whether we are
+    // waiting to repeat the command until retryAt instead.
+    unsigned long attemptTimeout;
+    bool backingOff;
+    unsigned long retryAt;
+    // Whether the command in flight is waiting for the "> " prompt, and
+    // whether its data has been written (after which it can't be retried).
+    bool prompting;
+    bool dataSent;
+    // Whether a line of the reply has been passed to the line callback, and
+    // when. From then on, the command only times out if the reply stops
+    // coming, and isn't repeated, as the repeated reply would run into this
+    // one.
+    bool replyStarted;
+    unsigned long replyStartedAt;
+
+    A6metrics metrics;
+    A6commandStats *stats;
+    A6replyTime replyTimes[A6_REPLY_TIME_SLOTS];
+    byte replyTimeCount;
+    // The reply time of the command in flight, or NULL if it isn't learned.
+    A6replyTime *replyTime;
+
+#if A6_TRACE_LEVEL > 0
+    A6traceRecord traceRecords[A6_TRACE_SIZE];
+    byte traceHead;
+    byte traceCount;
+    // The names of the commands in the trace, which command records refer to
+    // by their position.
+    char traceNames[A6_TRACE_NAME_SLOTS][A6_COMMAND_NAME_SIZE];
+    byte traceNameCount;
+    void trace(A6traceEvent event, long value);
+    long traceName();
+#endif
+
+    // Everything received since the current command was sent, NUL-terminated.
+    char rxBuffer[A6_RX_BUFFER_SIZE];
+    unsigned int rxLength;
+    // Where the line currently being received starts in rxBuffer.
+    unsigned int lineStart;
+
+    // The rate the serial connection was last started at, or 0.
+    long rate;
+    // The last rate the module answered at, or 0.
+    long knownRate;
+    A6rateLoad rateLoad;
+    A6rateSave rateSave;
+    void *rateContext;
+
+    // Set while waiting for the module to boot, until it says it's ready.
+    bool booting;
+    bool bootReady;
+    unsigned long bootLatency;
+
+    A6urcHandler urcHandlers[A6_MAX_URC_HANDLERS];
+    byte urcHandlerCount;
+
+    A6matcher matchers[2];
+    // Whether an expected response has been seen, and when the last byte came
+    // in.
+    bool matched;
+    unsigned long receivedAt;
+    // Set after a +CMGL or +CMGR header, while the message body that follows
+    // is coming in. The body is passed on as it is, even if it looks like an
+    // error or an unsolicited result.
+    bool inMessageBody;
+    // The result of the command in flight, once its reply has been seen.
+    byte result;
+    int lastError;
+    // Identifies the parts of the next concatenated SMS.
+    byte smsReference;
+    // Whether to turn the UCS2 hex of read messages into UTF-8.
+    bool smsDecoding;
+    // Cleared once the modem has refused to list messages without marking
+    // them read, so they are read one by one instead.
+    bool smsPeeking;
+
+    // SMS waiting to be sent, the first of which is being sent with
+    // smsEncoder once smsStarted is set.
+    A6outboundSMS smsQueue[A6_SMS_QUEUE_SIZE];
+    byte smsHead;
+    byte smsCount;
+    A6pduEncoder smsEncoder;
+    bool smsStarted;
+    int smsPartLength;
+    // Whether one of its commands is queued or in flight.
+    bool smsBusy;
+    byte smsAttempt;
+    unsigned long smsRetryAt;
+    // Whether the modem has been switched to PDU mode for sending.
+    bool pduMode;
+
+    A6socket sockets[A6_MAX_SOCKETS];
+    // How much of the +CIPRCV data being received is still to come, and which
+    // socket it's for.
+    unsigned int rawRemaining;
+    byte rawSocket;
+
+    int readAvailable();
+    void receiveByte(char c);
+    int receiveData();
+    bool socketLine(const char *line);
+    void lineReceived();
+    void messageBodyReceived(char *line);
+    void passLine(char *line);
+    bool dispatchUnsolicited(char *line, unsigned int length);
+    void sendNext();
+    void sendHead();
+    void finishHead(byte outcome);
+    void writeData();
+    void moveLastToFront();
+    void pollSMS();
+    byte sendSMSPart();
+    void smsPartDone(byte outcome, int reference);
+    void finishSMS(byte outcome, int reference);
+    static void smsModeSet(byte result, const char *response, void *context);
+    static void smsPartSent(byte result, const char *response, void *context);
+    static size_t writeSMSPart(Print &out, void *context);
+    byte enqueue(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, A6commandCallback callback, A6lineCallback lineCallback, A6writeCallback writer, void *context);
+    A6commandStats *findStats(const char *command);
+    A6replyTime *findReplyTime(const char *command);
+    byte A6command(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, String *response, A6lineCallback lineCallback = NULL, void *lineContext = NULL, A6writeCallback writer = NULL, void *writerContext = NULL);
+    byte listSMS(const char *type, A6smsList *list, bool keepStatus = false);
+    byte peekSMS(A6smsList *list);
+    byte A6query(const char *command, const char *prefix, char *line, size_t size, int timeout, int repetitions);
+    void init(Stream *serial, A6beginCallback begin);
+    void startSerial(long rate);
+    bool probeRate(long rate);
+    long detectRate(long preferred);
     char setRate(long baudRate);
 };
 #endif
@@ -0,0 +1,162 @@
+#ifndef A6parse_h
+#define A6parse_h
+
+#include <Arduino.h>
+#include <limits.h>
+
+// Typed parsers for the comma-separated fields of modem replies, such as
+//
+//     +CLCC: 1,1,4,0,0,"+1234567890",145
+//
+// The shape of each reply is described by the field arguments passed to
+// A6parse(), so every reply type gets its own parser at compile time, with no
+// format string to interpret at runtime:
+//
+//     A6parse(line, "+CSQ:", A6int(strength), A6int(error));
+//
+// Like sscanf, A6parse returns how many fields were parsed before the first one
+// that didn't fit.
+
+template <class T> struct A6intField {
+    T *value;
+};
+
+struct A6textField {
+    char *dest;
+    size_t size;
+};
+
+struct A6skipField {
+};
+
+// An integer (or enum) field.
+template <class T> inline A6intField<T> A6int(T &value) {
+    A6intField<T> field = { &value };
+    return field;
+}
+
+// A text field, optionally in double quotes, that is truncated to fit in dest.
+template <size_t N> inline A6textField A6text(char (&dest)[N]) {
+    A6textField field = { dest, N };
+    return field;
+}
+
+inline A6textField A6text(char *dest, size_t size) {
+    A6textField field = { dest, size };
+    return field;
+}
+
+// A field that is ignored.
+inline A6skipField A6skip() {
+    A6skipField field;
+    return field;
+}
+
+
+// Move past the separator after a field.
+inline const char *A6nextField(const char *p) {
+    while (*p == ' ') {
+        p++;
+    }
+    if (*p == ',') {
+        p++;
+    }
+    return p;
+}
+
+template <class T> const char *A6parseField(const char *p, A6intField<T> field) {
+    long value = 0;
+    bool negative = false;
+
+    while (*p == ' ') {
+        p++;
+    }
+    if (*p == '-' || *p == '+') {
+        negative = *p == '-';
+        p++;
+    }
+    if (*p < '0' || *p > '9') {
+        return NULL;
+    }
+    while (*p >= '0' && *p <= '9') {
+        // Saturate rather than overflow on garbage.
+        if (value <= (LONG_MAX - 9) / 10) {
+            value = value * 10 + (*p - '0');
+        }
+        p++;
+    }
+
+    *field.value = (T)(negative ? -value : value);
+    return A6nextField(p);
+}
+
+inline const char *A6parseField(const char *p, A6textField field) {
+    size_t len = 0;
+    char end = ',';
+
+    while (*p == ' ') {
+        p++;
+    }
+    if (*p == 0) {
+        return NULL;
+    }
+    if (*p == '"') {
+        end = '"';
+        p++;
+    }
+    while (*p && *p != end) {
+        if (len < field.size - 1) {
+            field.dest[len++] = *p;
+        }
+        p++;
+    }
+    field.dest[len] = 0;
+
+    if (end == '"') {
+        if (*p != '"') {
+            return NULL;
+        }
+        p++;
+    }
+    return A6nextField(p);
+}
+
+inline const char *A6parseField(const char *p, A6skipField field) {
+    bool quoted = false;
+
+    (void)field;
+    while (*p && (quoted || *p != ',')) {
+        if (*p == '"') {
+            quoted = !quoted;
+        }
+        p++;
+    }
+    return A6nextField(p);
+}
+
+
+inline int A6parseFields(const char *p) {
+    (void)p;
+    return 0;
+}
+
+template <class Field, class... Fields> int A6parseFields(const char *p, Field field, Fields... rest) {
+    p = A6parseField(p, field);
+    if (p == NULL) {
+        return 0;
+    }
+    return 1 + A6parseFields(p, rest...);
+}
+
+// Parse the fields of line, which must start with prefix. Returns the number of
+// fields parsed, or -1 if the line doesn't start with prefix.
+template <class... Fields> int A6parse(const char *line, const char *prefix, Fields... fields) {
+    size_t len = strlen(prefix);
+
+    if (strncmp(line, prefix, len) != 0) {
+        return -1;
+    }
+    return A6parseFields(line + len, fields...);
+}
+
+#endif
@@ -0,0 +1,215 @@
+#include <Arduino.h>
+#include "A6pool.h"
+
+A6pool::A6pool() {
+    memset(modems, 0, sizeof(modems));
+    modemCount = 0;
+    memset(jobs, 0, sizeof(jobs));
+    nextSequence = 1;
+    memset(&stats, 0, sizeof(stats));
+}
+
+
+byte A6pool::add(A6lib &modem) {
+    if (modemCount >= A6_POOL_MODEMS) {
+        return A6_NOTOK;
+    }
+
+    // Notice calls ending on their own: "NO CARRIER", "NO ANSWER", "NO
+    // DIALTONE" or "BUSY".
+    if (modem.onUnsolicited("NO ", callEnded, &modems[modemCount]) != A6_OK) {
+        return A6_NOTOK;
+    }
+    if (modem.onUnsolicited("BUSY", callEnded, &modems[modemCount]) != A6_OK) {
+        modem.removeUnsolicited("NO ");
+        return A6_NOTOK;
+    }
+
+    if (modemCount == 0) {
+        stats.startedAt = millis();
+    }
+    memset(&modems[modemCount], 0, sizeof(modems[0]));
+    modems[modemCount].modem = &modem;
+    modemCount++;
+    return A6_OK;
+}
+
+
+void A6pool::callEnded(const char *line, void *context) {
+    (void)line;
+    ((A6poolModem *)context)->inCall = false;
+}
+
+
+// Queue an SMS to be sent by whichever modem is free first. number and text
+// must stay valid until callback is called, with the result of the last
+// attempt.
+byte A6pool::queueSMS(const char *number, const char *text, A6smsCallback callback, void *context) {
+    for (byte i = 0; i < A6_POOL_JOBS; i++) {
+        A6poolJob *job = &jobs[i];
+
+        if (job->sequence == 0) {
+            job->pool = this;
+            job->number = number;
+            job->text = text;
+            job->callback = callback;
+            job->context = context;
+            job->sequence = nextSequence++;
+            job->modem = -1;
+            job->failedOn = -1;
+            job->attempts = 0;
+            return A6_OK;
+        }
+    }
+    return A6_NOTOK;
+}
+
+
+A6lib *A6pool::dial(const char *number) {
+    int i = pickModem(-1, true);
+
+    if (i < 0) {
+        return NULL;
+    }
+    modems[i].inCall = true;
+    modems[i].modem->dial(number);
+    return modems[i].modem;
+}
+
+
+void A6pool::hangUp(A6lib *modem) {
+    for (byte i = 0; i < modemCount; i++) {
+        if (modems[i].modem == modem) {
+            modem->hangUp();
+            modems[i].inCall = false;
+        }
+    }
+}
+
+
+void A6pool::poll() {
+    for (byte i = 0; i < modemCount; i++) {
+        modems[i].modem->poll();
+    }
+
+    // Hand the oldest waiting SMS to free modems, for as long as there are
+    // both.
+    A6poolJob *job;
+    while ((job = nextJob()) != NULL) {
+        int i = pickModem(job->failedOn, false);
+
+        if (i < 0 || modems[i].modem->queueSMS(job->number, job->text, smsDone, job) != A6_OK) {
+            break;
+        }
+        job->modem = i;
+        modems[i].busy = true;
+    }
+}
+
+
+// The oldest SMS that no modem is sending.
+A6poolJob *A6pool::nextJob() {
+    A6poolJob *oldest = NULL;
+
+    for (byte i = 0; i < A6_POOL_JOBS; i++) {
+        A6poolJob *job = &jobs[i];
+
+        if (job->sequence != 0 && job->modem < 0 && (oldest == NULL || job->sequence < oldest->sequence)) {
+            oldest = job;
+        }
+    }
+    return oldest;
+}
+
+
+// Pick the free, healthy modem that has failed least recently, avoiding avoid
+// if any other will do. Returns -1 if none is free.
+int A6pool::pickModem(int avoid, bool forCall) {
+    int best = -1;
+
+    for (byte i = 0; i < modemCount; i++) {
+        A6poolModem *m = &modems[i];
+
+        if (m->inCall || (!forCall && m->busy) || !isHealthy(i)) {
+            continue;
+        }
+        if (best < 0 || (best == avoid && i != avoid) || (i != avoid && m->failures < modems[best].failures)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+
+void A6pool::smsDone(byte result, int reference, void *context) {
+    A6poolJob *job = (A6poolJob *)context;
+    A6pool *pool = job->pool;
+    A6poolModem *m = &pool->modems[job->modem];
+
+    m->busy = false;
+    job->attempts++;
+
+    if (result == A6_OK) {
+        m->failures = 0;
+        m->sent++;
+        pool->stats.sent++;
+    } else {
+        m->failed++;
+        if (++m->failures >= A6_POOL_MAX_FAILURES) {
+            // Leave it alone for a while; what's queued goes to the others.
+            m->downUntil = millis() + A6_POOL_COOLDOWN;
+        }
+
+        if (job->attempts < A6_POOL_ATTEMPTS) {
+            // Try it on another modem.
+            job->failedOn = job->modem;
+            job->modem = -1;
+            pool->stats.moved++;
+            return;
+        }
+        pool->stats.failed++;
+    }
+
+    // Free the slot before calling back, so the callback can queue more.
+    A6smsCallback callback = job->callback;
+    void *callbackContext = job->context;
+    job->sequence = 0;
+    if (callback != NULL) {
+        callback(result, reference, callbackContext);
+    }
+}
+
+
+byte A6pool::getQueuedSMSCount() {
+    byte count = 0;
+
+    for (byte i = 0; i < A6_POOL_JOBS; i++) {
+        count += jobs[i].sequence != 0;
+    }
+    return count;
+}
+
+
+// Whether the modem is in rotation, rather than cooling down after failing.
+bool A6pool::isHealthy(byte modem) {
+    A6poolModem *m = &modems[modem];
+
+    if (m->failures >= A6_POOL_MAX_FAILURES) {
+        if ((long)(millis() - m->downUntil) < 0) {
+            return false;
+        }
+        // Give it another chance.
+        m->failures = A6_POOL_MAX_FAILURES - 1;
+    }
+    return true;
+}
+
+
+const A6poolModem &A6pool::getModem(byte modem) {
+    return modems[modem < modemCount ? modem : 0];
+}
+
+
+const A6poolStats &A6pool::getStats() {
+    return stats;
+}
@@ -0,0 +1,99 @@
+#ifndef A6pool_h
+#define A6pool_h
+
+#include <Arduino.h>
+#include "A6lib.h"
+
+// How many modems a pool can drive, and how many SMS it can hold.
+#ifndef A6_POOL_MODEMS
+#define A6_POOL_MODEMS 4
+#endif
+#ifndef A6_POOL_JOBS
+#define A6_POOL_JOBS 16
+#endif
+// How many times in a row a modem can fail to send before it's taken out of
+// rotation, and for how long, in ms.
+#define A6_POOL_MAX_FAILURES 3
+#define A6_POOL_COOLDOWN 60000
+// How many modems an SMS is tried on before giving up on it.
+#define A6_POOL_ATTEMPTS 3
+
+class A6pool;
+
+struct A6poolJob {
+    A6pool *pool;
+    const char *number;
+    const char *text;
+    A6smsCallback callback;
+    void *context;
+    // The order jobs were queued in, 0 for a free slot.
+    unsigned long sequence;
+    // The modem sending it, or -1 if it's waiting for one.
+    int8_t modem;
+    // The modem it last failed on, which is avoided if there are others.
+    int8_t failedOn;
+    byte attempts;
+};
+
+struct A6poolModem {
+    A6lib *modem;
+    bool inCall;
+    // Whether it's sending one of our SMS.
+    bool busy;
+    byte failures;
+    // When it can be used again, after failing too often.
+    unsigned long downUntil;
+    unsigned long sent;
+    unsigned long failed;
+};
+
+// Totals for all the modems since the pool was started. Dividing sent by the
+// time since startedAt gives the throughput.
+struct A6poolStats {
+    unsigned long startedAt;
+    unsigned long sent;
+    unsigned long failed;
+    // SMS moved to another modem after failing on one.
+    unsigned long moved;
+};
+
+// Spreads outbound SMS and calls over several modems, e.g. on a gateway with a
+// module on every serial port. SMS are queued in the pool and handed to one
+// healthy modem at a time each, so a burst goes out as fast as all the modems
+// can send, and SMS that fail on one modem are moved to another. A modem that
+// keeps failing is left alone for a while, and what's queued goes to the
+// others. Everything is driven by poll(), from a single loop.
+class A6pool {
+public:
+    A6pool();
+
+    // Add a modem, which should already be set up with begin(). The pool
+    // handles the unsolicited "NO " and "BUSY" lines, to tell when calls end.
+    byte add(A6lib &modem);
+    byte queueSMS(const char *number, const char *text, A6smsCallback callback, void *context);
+    // Dial on the healthiest modem that isn't in a call. Returns the modem, or
+    // NULL if none is free.
+    A6lib *dial(const char *number);
+    void hangUp(A6lib *modem);
+    // Drive all the modems. Call this as often as possible from loop().
+    void poll();
+
+    byte getQueuedSMSCount();
+    bool isHealthy(byte modem);
+    const A6poolModem &getModem(byte modem);
+    const A6poolStats &getStats();
+
+private:
+    A6poolModem modems[A6_POOL_MODEMS];
+    byte modemCount;
+    A6poolJob jobs[A6_POOL_JOBS];
+    unsigned long nextSequence;
+    A6poolStats stats;
+
+    int pickModem(int avoid, bool forCall);
+    A6poolJob *nextJob();
+    static void smsDone(byte result, int reference, void *context);
+    static void callEnded(const char *line, void *context);
+};
+
+#endif
@@ -13,6 +13,19 @@ int unreadSMSLocs[30] = {0};
 int unreadSMSNum = 0;
 SMSmessage sms;
 
+bool ringing = false;
+bool newSMS = false;
+
+// Called by A6l.poll() whenever the phone rings.
+void onRing(const char *line, void *context) {
+    ringing = true;
+}
+
+// Called by A6l.poll() whenever a new SMS arrives.
+void onNewSMS(const char *line, void *context) {
+    newSMS = true;
+}
+
 void setup() {
     Serial.begin(115200);
 
@@ -21,18 +34,31 @@ void setup() {
     // Power-cycle the module to reset it.
     A6l.powerCycle(D0);
     A6l.blockUntilReady(9600);
+
+    A6l.onUnsolicited("RING", onRing, NULL);
+    A6l.onUnsolicited("+CMTI:", onNewSMS, NULL);
+    A6l.enableSMSNotifications(1);
 }
 
 void loop() {
     String myNumber = "+1132352890";
 
-    callInfo cinfo = A6l.checkCallStatus();
-    if (cinfo.direction == DIR_INCOMING) {
-        if (myNumber.endsWith(cinfo.number)) {
-            // If the number that sent the SMS is ours, reply.
+    // Let the library look at what the modem has sent.
+    A6l.poll();
+
+    if (ringing) {
+        ringing = false;
+
+        callInfo cinfo = A6l.checkCallStatus();
+        if (cinfo.direction == DIR_INCOMING && myNumber.endsWith(cinfo.number)) {
+            // If the number that called is ours, reply.
             A6l.sendSMS(myNumber, "I can't come to the phone right now, I'm a machine.");
             A6l.hangUp();
         }
+    }
+
+    if (newSMS) {
+        newSMS = false;
 
         // Get the memory locations of unread SMS messages.
         unreadSMSNum = A6l.getUnreadSMSLocs(unreadSMSLocs, 30);
@@ -46,6 +72,5 @@ void loop() {
             Serial.println(sms.date);
             Serial.println(sms.message);
         }
-        delay(1000);
     }
 }
@@ -0,0 +1,190 @@
+#include <Arduino.h>
+#include "A6before.h"
+
+A6before::A6before(Stream &serial) {
+    A6conn = &serial;
+    A6conn->setTimeout(100);
+}
+
+
+// Read some data from the A6 in a non-blocking manner.
+String A6before::read() {
+    String reply = "";
+    if (A6conn->available()) {
+        reply = A6conn->readString();
+    }
+
+    // XXX: Replace NULs with \xff so we can match on them.
+    for (unsigned int x = 0; x < reply.length(); x++) {
+        if (reply.charAt(x) == 0) {
+            reply.setCharAt(x, 255);
+        }
+    }
+    return reply;
+}
+
+
+// Issue a command.
+byte A6before::A6command(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, String *response) {
+    byte returnValue = A6_NOTOK;
+    byte count = 0;
+
+    // Get rid of any buffered output.
+    A6conn->flush();
+
+    while (count < repetitions && returnValue != A6_OK) {
+        A6conn->write(command);
+        A6conn->write('\r');
+
+        if (A6waitFor(resp1, resp2, timeout, response) == A6_OK) {
+            returnValue = A6_OK;
+        } else {
+            returnValue = A6_NOTOK;
+        }
+        count++;
+    }
+    return returnValue;
+}
+
+
+// Wait for responses.
+byte A6before::A6waitFor(const char *resp1, const char *resp2, int timeout, String *response) {
+    unsigned long entry = millis();
+    String reply = "";
+    byte retVal = 99;
+    do {
+        reply += read();
+#ifdef ESP8266
+        yield();
+#endif
+    } while (((reply.indexOf(resp1) + reply.indexOf(resp2)) == -2) && ((millis() - entry) < (unsigned long)timeout));
+
+    if (response != NULL) {
+        *response = reply;
+    }
+
+    if ((millis() - entry) >= (unsigned long)timeout) {
+        retVal = A6_TIMEOUT;
+    } else {
+        if (reply.indexOf(resp1) + reply.indexOf(resp2) > -2) {
+            retVal = A6_OK;
+        } else {
+            retVal = A6_NOTOK;
+        }
+    }
+    return retVal;
+}
+
+
+// The settings begin() made once it had set the rate.
+byte A6before::configure() {
+    // Factory reset.
+    A6command("AT&F", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+
+    // Echo off.
+    A6command("ATE0", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+
+    // Switch audio to headset.
+    A6command("AT+SNFS=0", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+
+    // Set caller ID on.
+    A6command("AT+CLIP=1", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+
+    // Set SMS to text mode.
+    A6command("AT+CMGF=1", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+
+    // Turn SMS indicators off.
+    A6command("AT+CNMI=1,0", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+
+    // Set SMS storage to the GSM modem.
+    if (A6_OK != A6command("AT+CPMS=ME,ME,ME", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL)) {
+        return A6_FAILURE;
+    }
+
+    // Set SMS character set.
+    A6command("AT+CSCS=\"UCS2\"", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+
+    return A6_OK;
+}
+
+
+// Send an SMS.
+byte A6before::sendSMS(String number, String text) {
+    char ctrlZ[2] = { 0x1a, 0x00 };
+    char buffer[100];
+
+    if (text.length() > 159) {
+        // We can't send messages longer than 160 characters.
+        return A6_NOTOK;
+    }
+
+    sprintf(buffer, "AT+CMGS=\"%s\"", number.c_str());
+    A6command(buffer, ">", "yy", A6_CMD_TIMEOUT, 2, NULL);
+    delay(100);
+    A6conn->println(text.c_str());
+    A6conn->println(ctrlZ);
+    A6conn->println();
+
+    return A6_OK;
+}
+
+
+// Retrieve the number and locations of all SMS messages.
+int A6before::getSMSLocsOfType(int* buf, int maxItems, String type) {
+    String seqStart = "+CMGL: ";
+    String response = "";
+
+    String command = "AT+CMGL=\"";
+    command += type;
+    command += "\"";
+
+    // Issue the command and wait for the response.
+    A6command(command.c_str(), "\xff\r\nOK\r\n", "\r\nOK\r\n", A6_CMD_TIMEOUT, 2, &response);
+
+    int seqStartLen = seqStart.length();
+    int responseLen = response.length();
+    int index, occurrences = 0;
+
+    // Start looking for the +CMGL string.
+    for (int i = 0; i < (responseLen - seqStartLen); i++) {
+        // If we found a response and it's less than occurrences, add it.
+        if (response.substring(i, i + seqStartLen) == seqStart && occurrences < maxItems) {
+            // Parse the position out of the reply.
+            A6beforeSscanf(response.substring(i, i + 12).c_str(), "+CMGL: %u,%*s", (unsigned *)&index);
+
+            buf[occurrences] = index;
+            occurrences++;
+        }
+    }
+    return occurrences;
+}
+
+// Return the SMS at index.
+SMSmessage A6before::readSMS(int index) {
+    String response = "";
+    char buffer[30];
+
+    // Issue the command and wait for the response.
+    sprintf(buffer, "AT+CMGR=%d", index);
+    A6command(buffer, "\xff\r\nOK\r\n", "\r\nOK\r\n", A6_CMD_TIMEOUT, 2, &response);
+
+    char number[50];
+    char date[50];
+    char type[10];
+    int respStart = 0;
+    SMSmessage sms = (const struct SMSmessage) {
+        "", "", ""
+    };
+
+    // Parse the response if it contains a valid +CLCC.
+    respStart = response.indexOf("+CMGR");
+    if (respStart >= 0) {
+        // Parse the message header.
+        A6beforeSscanf(response.substring(respStart).c_str(), "+CMGR: \"REC %s\",\"%s\",,\"%s\"\r\n", type, number, date);
+        sms.number = String(number);
+        sms.date = String(date);
+        // The rest is the message, extract it.
+        sms.message = response.substring(strlen(type) + strlen(number) + strlen(date) + 24, response.length() - 8);
+    }
+    return sms;
+}
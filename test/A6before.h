@@ -0,0 +1,31 @@
+#ifndef A6before_h
+#define A6before_h
+
+#include <Arduino.h>
+#include "A6lib.h"
+
+// A6lib as it was before the changes the benchmarks measure (the "baseline"
+// commit), cut down to the parts they compare against, so that the old and
+// the new code can be run against the same simulated module. The code is kept
+// as it was, String allocations and all, apart from the logging and what the
+// compiler warns about.
+class A6before {
+public:
+    A6before(Stream &serial);
+
+    byte A6command(const char *command, const char *resp1, const char *resp2, int timeout, int repetitions, String *response);
+    byte configure();
+    byte sendSMS(String number, String text);
+    int getSMSLocsOfType(int* buf, int maxItems, String type);
+    SMSmessage readSMS(int index);
+
+private:
+    Stream *A6conn;
+
+    String read();
+    byte A6waitFor(const char *resp1, const char *resp2, int timeout, String *response);
+};
+
+int A6beforeSscanf(const char *buf, const char *fmt, ...);
+
+#endif
@@ -34,11 +34,16 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include "A6before.h"
+
+// The sscanf() the library came with, which the old parsers relied on: it
+// treats '"' as a space, so "%s" stops at the end of a quoted field. The names
+// are changed so that it doesn't replace the C library's.
 
 #define MAXLN 200
 #define ISSPACE " \t\n\r\f\v\""
 
-size_t strcspn(const char *p, const char *s) {
+static size_t A6beforeStrcspn(const char *p, const char *s) {
     int i, j;
 
     for (i = 0; p[i]; i++) {
@@ -54,7 +59,7 @@ size_t strcspn(const char *p, const char *s) {
     return (i);
 }
 
-char * _getbase(char *p, int *basep) {
+static char * _getbase(char *p, int *basep) {
     if (p[0] == '0') {
         switch (p[1]) {
         case 'x':
@@ -80,7 +85,7 @@ char * _getbase(char *p, int *basep) {
 /*
  *  _atob(vp,p,base)
  */
-int _atob(uint32_t *vp, char *p, int base) {
+static int _atob(uint32_t *vp, char *p, int base) {
     uint32_t value, v1, v2;
     char *q, tmp[20];
     int digit;
@@ -91,7 +96,7 @@ int _atob(uint32_t *vp, char *p, int base) {
     }
 
     if (base == 16 && (q = strchr(p, '.')) != 0) {
-        if (q - p > sizeof(tmp) - 1) {
+        if ((size_t)(q - p) > sizeof(tmp) - 1) {
             return (0);
         }
 
@@ -139,7 +144,7 @@ int _atob(uint32_t *vp, char *p, int base) {
  *  atob(vp,p,base)
  *      converts p to binary result in vp, rtn 1 on success
  */
-int atob(uint32_t *vp, char *p, int base) {
+static int atob(uint32_t *vp, char *p, int base) {
     uint32_t v;
     if (base == 0) {
         p = _getbase(p, &base);
@@ -155,12 +160,12 @@ int atob(uint32_t *vp, char *p, int base) {
  *  vsscanf(buf,fmt,ap)
  */
 
-int vsscanf(const char *buf, const char *s, va_list ap) {
+static int A6beforeVsscanf(const char *buf, const char *s, va_list ap) {
     uint32_t             count, noassign, width, base, lflag;
     const char     *tc;
     char           *t, tmp[MAXLN];
 
-    count = noassign = width = lflag = 0;
+    count = noassign = width = lflag = base = 0;
     while (*s && *buf) {
         while (isspace(*s)) {
             s++;
@@ -188,7 +193,7 @@ int vsscanf(const char *buf, const char *s, va_list ap) {
                     buf++;
                 }
                 if (!width) {
-                    width = strcspn(buf, ISSPACE);
+                    width = A6beforeStrcspn(buf, ISSPACE);
                 }
                 if (!noassign) {
                     strncpy(t = va_arg(ap, char *), buf, width);
@@ -219,7 +224,7 @@ int vsscanf(const char *buf, const char *s, va_list ap) {
                 }
                 if (!width) {
                     if (isspace(*(s + 1)) || *(s + 1) == 0) {
-                        width = strcspn(buf, ISSPACE);
+                        width = A6beforeStrcspn(buf, ISSPACE);
                     } else {
                         width = strchr(buf, *(s + 1)) - buf;
                     }
@@ -251,12 +256,12 @@ int vsscanf(const char *buf, const char *s, va_list ap) {
 }
 
 
-int __attribute__((used)) sscanf(const char *buf, const char *fmt, ...) {
+int A6beforeSscanf(const char *buf, const char *fmt, ...) {
     int             count;
     va_list ap;
 
     va_start(ap, fmt);
-    count = vsscanf(buf, fmt, ap);
+    count = A6beforeVsscanf(buf, fmt, ap);
     va_end(ap);
     return (count);
 }
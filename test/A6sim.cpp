@@ -0,0 +1,597 @@
+#include "A6sim.h"
+
+#define A6SIM_DATE "17/01/01,10:00:00+08"
+
+A6sim::A6sim() {
+    A6shimNoCount noCount;
+
+    echo = false;
+    pduMode = false;
+    charset = "IRA";
+    signal = 20;
+    registration = 1;
+    clock = A6SIM_DATE;
+    fixedRate = 0;
+    storageFails = false;
+    smsFailures = 0;
+    bytesIn = 0;
+    bytesOut = 0;
+    rate = 0;
+    latency = 0;
+    dropCount = 0;
+    garbleEvery = 0;
+    garbleCount = 0;
+    prompt = NO_PROMPT;
+    promptLength = 0;
+    promptSocket = 0;
+    callStatus = A6SIM_IDLE;
+    callDirection = 0;
+    smsReference = 0;
+    memset(sockets, 0, sizeof(sockets));
+    replying = false;
+}
+
+
+void A6sim::setLatency(unsigned long ms) {
+    latency = ms;
+}
+
+
+void A6sim::setLatency(const std::string &command, unsigned long ms) {
+    A6shimNoCount noCount;
+
+    latencies[command] = ms;
+}
+
+
+void A6sim::dropReplies(int count) {
+    dropCount = count;
+}
+
+
+void A6sim::garble(int n) {
+    garbleEvery = n;
+}
+
+
+void A6sim::inject(const std::string &text, unsigned long ms) {
+    A6shimNoCount noCount;
+
+    send(text, ms);
+}
+
+
+int A6sim::receiveSMS(const std::string &number, const std::string &text) {
+    A6shimNoCount noCount;
+    int index = 1;
+
+    while (store.count(index)) {
+        index++;
+    }
+    A6simSMS sms = { "REC UNREAD", number, A6SIM_DATE, text };
+    store[index] = sms;
+    send("\r\n+CMTI: \"ME\"," + std::to_string(index) + "\r\n");
+    return index;
+}
+
+
+void A6sim::ring(const std::string &number) {
+    A6shimNoCount noCount;
+
+    callStatus = 4;
+    callDirection = 1;
+    callNumber = number;
+    send("\r\nRING\r\n\r\n+CLIP: \"" + number + "\",145\r\n");
+}
+
+
+void A6sim::answerCall() {
+    if (callStatus == 2 || callStatus == 3) {
+        callStatus = 0;
+    }
+}
+
+
+void A6sim::hangUpCall() {
+    A6shimNoCount noCount;
+
+    if (callStatus != A6SIM_IDLE) {
+        callStatus = A6SIM_IDLE;
+        send("\r\nNO CARRIER\r\n");
+    }
+}
+
+
+int A6sim::callState() {
+    return callStatus;
+}
+
+
+void A6sim::closeSocket(int socket) {
+    A6shimNoCount noCount;
+
+    if (sockets[socket]) {
+        sockets[socket] = false;
+        // From onSocketData, the reply goes first.
+        if (!replying) {
+            send(std::to_string(socket) + ", CLOSED\r\n");
+        }
+    }
+}
+
+
+/////////////////////////////////////////////
+// The serial connection.
+//
+
+// Switching rates loses whatever was on the wire.
+void A6sim::begin(long rate) {
+    A6shimNoCount noCount;
+
+    this->rate = rate;
+    output.clear();
+    line.clear();
+}
+
+
+bool A6sim::rateMatches() {
+    return fixedRate == 0 || rate == fixedRate;
+}
+
+
+// How long a byte takes on the wire, in ms, with a start and a stop bit.
+double A6sim::byteTime() {
+    return rate > 0 ? 10000.0 / rate : 0;
+}
+
+
+int A6sim::available() {
+    A6shimNoCount noCount;
+    double now = A6shimNow();
+    size_t count = 0;
+
+    for (size_t i = 0; i < output.size() && output[i].at <= now; i++) {
+        size_t arrived = output[i].data.size();
+        if (byteTime() > 0 && (now - output[i].at) / byteTime() + 1 < arrived) {
+            arrived = (now - output[i].at) / byteTime() + 1;
+        }
+        count += arrived;
+    }
+    return count;
+}
+
+
+int A6sim::peek() {
+    A6shimNoCount noCount;
+
+    if (output.empty() || output[0].at > A6shimNow()) {
+        return -1;
+    }
+    return (byte)output[0].data[0];
+}
+
+
+int A6sim::read() {
+    A6shimNoCount noCount;
+
+    if (output.empty() || output[0].at > A6shimNow()) {
+        return -1;
+    }
+
+    byte c = output[0].data[0];
+    output[0].data.erase(0, 1);
+    output[0].at += byteTime();
+    if (output[0].data.empty()) {
+        output.erase(output.begin());
+    }
+    bytesOut++;
+    if (garbleEvery > 0 && ++garbleCount % garbleEvery == 0) {
+        c = (byte)random(256);
+    }
+    return c;
+}
+
+
+// Queue data to be sent delay ms from now, after what's already queued.
+void A6sim::send(const std::string &data, unsigned long delay) {
+    Output out = { (double)A6shimNow() + delay, data };
+
+    if (data.empty() || !rateMatches()) {
+        return;
+    }
+    if (!output.empty()) {
+        double end = output.back().at + output.back().data.size() * byteTime();
+        if (end > out.at) {
+            out.at = end;
+        }
+    }
+    output.push_back(out);
+}
+
+
+size_t A6sim::write(uint8_t c) {
+    A6shimNoCount noCount;
+
+    bytesIn++;
+    if (!rateMatches()) {
+        return 1;
+    }
+
+    if (prompt != NO_PROMPT) {
+        payloadByte(c);
+    } else if (c == '\r') {
+        if (echo) {
+            send(line + "\r");
+        }
+        commandLine(line);
+        line.clear();
+    } else if (c != '\n') {
+        line += (char)c;
+    }
+    return 1;
+}
+
+
+/////////////////////////////////////////////
+// Commands.
+//
+
+// The name of a command, for latencies, e.g. "+CMGL" for "+CMGL=\"ALL\"".
+static std::string A6simName(const std::string &command) {
+    if (command[0] != '+') {
+        return command.substr(0, 1);
+    }
+    return command.substr(0, command.find_first_of("=?"));
+}
+
+
+// Handle a command line, which can have several commands, e.g.
+// "AT&FE0+CMGF=1;+CNMI=1,0".
+void A6sim::commandLine(const std::string &line) {
+    std::string reply;
+    size_t i = 2;
+    bool ok = true;
+    unsigned long delay = latency;
+
+    if (line.empty()) {
+        return;
+    }
+    commands.push_back(line);
+    if (dropCount > 0) {
+        dropCount--;
+        return;
+    }
+    if (line.compare(0, 2, "AT") != 0) {
+        send("\r\nERROR\r\n");
+        return;
+    }
+
+    while (ok && i < line.size()) {
+        size_t end = i + 1;
+
+        if (line[i] == '+') {
+            bool quoted = false;
+
+            while (end < line.size() && (quoted || line[end] != ';')) {
+                quoted ^= line[end] == '"';
+                end++;
+            }
+        } else if (line[i] == 'D') {
+            end = line.size();
+        } else {
+            if (line[i] == '&') {
+                end++;
+            }
+            while (end < line.size() && isdigit((byte)line[end])) {
+                end++;
+            }
+        }
+
+        std::string command = line.substr(i, end - i);
+        std::string response;
+        i = end + (end < line.size() && line[end] == ';');
+
+        if (latencies.count(A6simName(command))) {
+            delay = latencies[A6simName(command)];
+        }
+        if (onCommand && onCommand(command, response)) {
+            send(reply + response, delay);
+            return;
+        }
+        Result result = this->command(command, response);
+        reply += response;
+        if (result == DONE) {
+            send(reply, delay);
+            return;
+        }
+        ok = result == OK;
+    }
+
+    send(ok ? reply + "\r\nOK\r\n" : reply, delay);
+}
+
+
+// Handle one command. Returns ERROR, with the error in reply, if it failed, and
+// DONE if reply is all there is to say (e.g. a prompt).
+A6sim::Result A6sim::command(const std::string &command, std::string &reply) {
+    if (command == "E0" || command == "E1") {
+        echo = command == "E1";
+    } else if (command == "&F") {
+        echo = true;
+        pduMode = false;
+        charset = "IRA";
+    } else if (command == "A") {
+        if (callStatus != 4) {
+            reply = "\r\nNO CARRIER\r\n";
+            return ERROR;
+        }
+        callStatus = 0;
+    } else if (command == "H" || command == "+CHUP") {
+        callStatus = A6SIM_IDLE;
+    } else if (command[0] == 'D' || command == "+DLST") {
+        if (command[0] == 'D') {
+            lastDialed = command.substr(1, command.find(';') - 1);
+        } else if (lastDialed.empty()) {
+            reply = "\r\nERROR\r\n";
+            return ERROR;
+        }
+        callStatus = 2;
+        callDirection = 0;
+        callNumber = lastDialed;
+    } else if (command == "+CLCC") {
+        if (callStatus != A6SIM_IDLE) {
+            reply = "\r\n+CLCC: 1," + std::to_string(callDirection) + "," + std::to_string(callStatus) + ",0,0,\"" + callNumber + "\",145\r\n";
+        }
+    } else if (command == "+CSQ") {
+        reply = "\r\n+CSQ: " + std::to_string(signal) + ",99\r\n";
+    } else if (command == "+CREG?") {
+        reply = "\r\n+CREG: 1," + std::to_string(registration) + "\r\n";
+    } else if (command == "+CCLK?") {
+        reply = "\r\n+CCLK: \"" + clock + "\"\r\n";
+    } else if (command.compare(0, 5, "+IPR=") == 0) {
+        // The OK still goes out at the old rate.
+        send("\r\nOK\r\n");
+        fixedRate = atol(command.c_str() + 5);
+        return DONE;
+    } else if (command.compare(0, 6, "+CPMS=") == 0) {
+        if (storageFails) {
+            reply = "\r\n+CME ERROR: 302\r\n";
+            return ERROR;
+        }
+        reply = "\r\n+CPMS: " + std::to_string(store.size()) + ",50," + std::to_string(store.size()) + ",50," + std::to_string(store.size()) + ",50\r\n";
+    } else if (command.compare(0, 6, "+CSCS=") == 0) {
+        std::string name = command.substr(7, command.size() - 8);
+
+        if (name != "GSM" && name != "IRA" && name != "UCS2" && name != "HEX") {
+            reply = "\r\n+CME ERROR: 4\r\n";
+            return ERROR;
+        }
+        charset = name;
+    } else if (command == "+CMGF=0" || command == "+CMGF=1") {
+        pduMode = command == "+CMGF=0";
+    } else if (command.compare(0, 6, "+CLIP=") == 0 || command.compare(0, 6, "+SNFS=") == 0 ||
+               command.compare(0, 6, "+CLVL=") == 0 || command.compare(0, 6, "+CNMI=") == 0 ||
+               command.compare(0, 6, "+CREG=") == 0) {
+        // Settings that don't change what we simulate.
+    } else if (command.compare(0, 3, "+CM") == 0) {
+        return smsCommand(command, reply);
+    } else if (command.compare(0, 3, "+CG") == 0 || command.compare(0, 3, "+CI") == 0) {
+        return gprsCommand(command, reply);
+    } else {
+        reply = "\r\nERROR\r\n";
+        return ERROR;
+    }
+    return OK;
+}
+
+
+// Whether a text mode message status matches what AT+CMGL asked for.
+static bool A6simListed(const std::string &status, const std::string &type) {
+    return type == "ALL" || type == status;
+}
+
+
+A6sim::Result A6sim::smsCommand(const std::string &command, std::string &reply) {
+    if (command.compare(0, 6, "+CMGL=") == 0 && !pduMode) {
+        size_t quote = command.find('"', 7);
+        std::string type = command.substr(7, quote - 7);
+        // Mode 1 leaves the status as it is.
+        bool keepStatus = command.compare(quote + 1, std::string::npos, ",1") == 0;
+
+        for (std::map<int, A6simSMS>::iterator it = store.begin(); it != store.end(); ++it) {
+            if (A6simListed(it->second.status, type)) {
+                reply += listEntry(it->first, it->second, true);
+                // Listing marks what was unread as read.
+                if (it->second.status == "REC UNREAD" && !keepStatus) {
+                    it->second.status = "REC READ";
+                }
+            }
+        }
+        if (!reply.empty()) {
+            reply = "\r\n" + reply;
+        }
+    } else if (command.compare(0, 6, "+CMGR=") == 0 && !pduMode) {
+        int index = atoi(command.c_str() + 6);
+
+        if (!store.count(index)) {
+            reply = "\r\n+CMS ERROR: 321\r\n";
+            return ERROR;
+        }
+        reply = "\r\n" + listEntry(index, store[index], false);
+        if (store[index].status == "REC UNREAD") {
+            store[index].status = "REC READ";
+        }
+    } else if (command.compare(0, 6, "+CMGD=") == 0) {
+        int index = atoi(command.c_str() + 6);
+        size_t comma = command.find(',');
+        int flag = comma != std::string::npos ? atoi(command.c_str() + comma + 1) : 0;
+
+        for (std::map<int, A6simSMS>::iterator it = store.begin(); it != store.end();) {
+            const std::string &status = it->second.status;
+            bool remove = flag == 4 || (flag == 0 && it->first == index) ||
+                          (flag >= 1 && status == "REC READ") ||
+                          (flag >= 2 && status == "STO SENT") ||
+                          (flag >= 3 && status == "STO UNSENT");
+
+            if (remove) {
+                store.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    } else if (command.compare(0, 6, "+CMGS=") == 0) {
+        prompt = SMS_PROMPT;
+        promptHeader = command.substr(6);
+        payload.clear();
+        reply = "\r\n> ";
+        return DONE;
+    } else {
+        reply = "\r\n+CMS ERROR: 302\r\n";
+        return ERROR;
+    }
+    return OK;
+}
+
+
+A6sim::Result A6sim::gprsCommand(const std::string &command, std::string &reply) {
+    if (command.compare(0, 10, "+CIPSTART=") == 0) {
+        int socket = atoi(command.c_str() + 10);
+        size_t hostStart = command.find("\",\"") + 3;
+        std::string host = command.substr(hostStart, command.find('"', hostStart) - hostStart);
+        bool reachable = true;
+
+        for (size_t i = 0; i < unreachable.size(); i++) {
+            reachable &= unreachable[i] != host;
+        }
+        sockets[socket] = reachable;
+        // The result comes after the OK.
+        reply = "\r\nOK\r\n\r\n" + std::to_string(socket) + (reachable ? ", CONNECT OK\r\n" : ", CONNECT FAIL\r\n");
+        return DONE;
+    } else if (command.compare(0, 9, "+CIPSEND=") == 0) {
+        int socket = atoi(command.c_str() + 9);
+
+        if (!sockets[socket]) {
+            reply = "\r\nERROR\r\n";
+            return ERROR;
+        }
+        prompt = SOCKET_PROMPT;
+        promptSocket = socket;
+        promptLength = atoi(command.c_str() + command.find(',') + 1);
+        payload.clear();
+        reply = "\r\n> ";
+        return DONE;
+    } else if (command.compare(0, 10, "+CIPCLOSE=") == 0) {
+        int socket = atoi(command.c_str() + 10);
+
+        sockets[socket] = false;
+        reply = "\r\n" + std::to_string(socket) + ", CLOSE OK\r\n";
+        return DONE;
+    } else if (command.compare(0, 7, "+CGATT=") != 0 && command.compare(0, 9, "+CGDCONT=") != 0 &&
+               command.compare(0, 7, "+CGACT=") != 0 && command.compare(0, 8, "+CIPMUX=") != 0) {
+        reply = "\r\nERROR\r\n";
+        return ERROR;
+    }
+    return OK;
+}
+
+
+// Collect the data after a "> " prompt.
+void A6sim::payloadByte(char c) {
+    if (prompt == SOCKET_PROMPT) {
+        payload += c;
+        if (payload.size() < promptLength) {
+            return;
+        }
+
+        prompt = NO_PROMPT;
+        send("\r\n" + std::to_string(promptSocket) + ", SEND OK\r\n");
+        replying = true;
+        std::string response = onSocketData ? onSocketData(promptSocket, payload) : "";
+        replying = false;
+        for (size_t i = 0; i < response.size(); i += 50) {
+            std::string chunk = response.substr(i, 50);
+            send("+CIPRCV:" + std::to_string(promptSocket) + "," + std::to_string(chunk.size()) + "," + chunk + "\r\n");
+        }
+        if (!sockets[promptSocket]) {
+            send(std::to_string(promptSocket) + ", CLOSED\r\n");
+        }
+        return;
+    }
+
+    if (c == 0x1b) {
+        // Escape cancels the message.
+        prompt = NO_PROMPT;
+        send("\r\nOK\r\n");
+        return;
+    }
+    if (c != 0x1a) {
+        payload += c;
+        return;
+    }
+
+    prompt = NO_PROMPT;
+    if (pduMode) {
+        // The length given is that of the TPDU, without the SMSC address.
+        unsigned int smscLength = strtol(payload.substr(0, 2).c_str(), NULL, 16);
+
+        if (payload.size() % 2 != 0 || payload.size() / 2 != 1 + smscLength + atoi(promptHeader.c_str())) {
+            send("\r\n+CMS ERROR: 304\r\n");
+            return;
+        }
+    }
+    if (smsFailures > 0) {
+        smsFailures--;
+        send("\r\n+CMS ERROR: 500\r\n");
+        return;
+    }
+
+    A6simSent message = { pduMode, promptHeader, payload };
+    sent.push_back(message);
+    smsReference = (smsReference + 1) % 256;
+    send("\r\n+CMGS: " + std::to_string(smsReference) + "\r\n\r\nOK\r\n");
+}
+
+
+// Text as the module would send it in the current character set.
+std::string A6sim::encode(const std::string &text) {
+    static const char digits[] = "0123456789ABCDEF";
+    std::string hex;
+
+    if (charset != "UCS2") {
+        return text;
+    }
+
+    for (size_t i = 0; i < text.size();) {
+        byte c = text[i];
+        unsigned long code;
+        int extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+
+        code = extra == 0 ? c : c & (0x3f >> extra);
+        for (int k = 1; k <= extra && i + k < text.size(); k++) {
+            code = (code << 6) | (text[i + k] & 0x3f);
+        }
+        i += 1 + extra;
+
+        unsigned long units[2] = { code, 0 };
+        int count = 1;
+        if (code >= 0x10000) {
+            units[0] = 0xd800 + ((code - 0x10000) >> 10);
+            units[1] = 0xdc00 + ((code - 0x10000) & 0x3ff);
+            count = 2;
+        }
+        for (int u = 0; u < count; u++) {
+            for (int shift = 12; shift >= 0; shift -= 4) {
+                hex += digits[(units[u] >> shift) & 0xf];
+            }
+        }
+    }
+    return hex;
+}
+
+
+// A message as listed by AT+CMGL or read by AT+CMGR.
+std::string A6sim::listEntry(int index, const A6simSMS &sms, bool list) {
+    std::string entry = list ? "+CMGL: " + std::to_string(index) + "," : "+CMGR: ";
+
+    return entry + "\"" + sms.status + "\",\"" + encode(sms.number) + "\",,\"" + sms.date + "\"\r\n" + encode(sms.text) + "\r\n";
+}
@@ -0,0 +1,160 @@
+#ifndef A6sim_h
+#define A6sim_h
+
+#include <Arduino.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// A simulated A6 module, to run the library against on a PC. It answers the
+// commands the library uses the way the module does, with an SMS store, calls,
+// GPRS sockets and baud rate detection, and it can be made slow, unreliable or
+// noisy:
+//
+//     A6sim sim;
+//     A6lib modem(sim);
+//
+//     sim.setLatency("+CMGL", 800);
+//     sim.receiveSMS("+301234", "Hello");
+//     sim.ring("+301234");
+//
+// Anything it doesn't do can be scripted with onCommand().
+
+#define A6SIM_IDLE -1
+
+struct A6simSMS {
+    std::string status;
+    std::string number;
+    std::string date;
+    // UTF-8.
+    std::string text;
+};
+
+// A message sent with AT+CMGS.
+struct A6simSent {
+    bool pdu;
+    // The number in text mode, the TPDU length in PDU mode.
+    std::string header;
+    std::string payload;
+};
+
+class A6sim : public Stream {
+public:
+    A6sim();
+
+    // Called with every command (without "AT", e.g. "+CSQ" or "D+301234;") before
+    // it's handled. Return true and set reply to answer it yourself. The reply
+    // should include the final result code, e.g. "\r\nOK\r\n".
+    std::function<bool(const std::string &command, std::string &reply)> onCommand;
+    // Called with the data of every AT+CIPSEND. What it returns is sent back
+    // over the socket. If it calls closeSocket(), the socket is closed after
+    // that.
+    std::function<std::string(int socket, const std::string &data)> onSocketData;
+
+    // Every command line received, without the trailing CR.
+    std::vector<std::string> commands;
+    std::vector<A6simSent> sent;
+    std::map<int, A6simSMS> store;
+
+    // How the module is set up.
+    bool echo;
+    bool pduMode;
+    std::string charset;
+    int signal;
+    // +CREG status, 1 for registered.
+    int registration;
+    std::string clock;
+    // The rate the module is fixed at with AT+IPR, or 0 for autobauding.
+    long fixedRate;
+    // Whether AT+CPMS fails, as it sometimes does until the module is
+    // rebooted.
+    bool storageFails;
+
+    // How many of the next AT+CMGS fail with +CMS ERROR: 500.
+    int smsFailures;
+    // Hosts that AT+CIPSTART can't connect to.
+    std::vector<std::string> unreachable;
+
+    // Delay every reply by ms, or only the replies to one command (e.g.
+    // "+CMGL").
+    void setLatency(unsigned long ms);
+    void setLatency(const std::string &command, unsigned long ms);
+    // Don't answer the next count command lines.
+    void dropReplies(int count);
+    // Replace one in every n bytes sent with noise (0 for none).
+    void garble(int n);
+
+    // Send something unsolicited, now or after ms.
+    void inject(const std::string &text, unsigned long ms = 0);
+    // A message arrives, and is announced with +CMTI. Returns its index.
+    int receiveSMS(const std::string &number, const std::string &text);
+    // Someone calls, and the module rings.
+    void ring(const std::string &number);
+    // The other side answers the call we dialed, or hangs up.
+    void answerCall();
+    void hangUpCall();
+    // The call state, as in +CLCC (0 active, 2 dialing, 3 alerting, 4
+    // incoming), or A6SIM_IDLE.
+    int callState();
+    // The other side closes a socket.
+    void closeSocket(int socket);
+
+    // How many bytes the library wrote, and how many were sent to it.
+    unsigned long bytesIn;
+    unsigned long bytesOut;
+    // The rate the library last started the connection at.
+    long rate;
+
+    void begin(long rate);
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+    using Print::write;
+
+private:
+    struct Output {
+        // When the first byte arrives. The rest follow at the baud rate.
+        double at;
+        std::string data;
+    };
+    std::vector<Output> output;
+    std::string line;
+    unsigned long latency;
+    std::map<std::string, unsigned long> latencies;
+    int dropCount;
+    int garbleEvery;
+    unsigned long garbleCount;
+
+    // What AT+CMGS or AT+CIPSEND is waiting for, if anything.
+    enum { NO_PROMPT, SMS_PROMPT, SOCKET_PROMPT } prompt;
+    std::string promptHeader;
+    size_t promptLength;
+    int promptSocket;
+    std::string payload;
+
+    int callStatus;
+    int callDirection;
+    std::string callNumber;
+    std::string lastDialed;
+    int smsReference;
+    bool sockets[8];
+    // Whether onSocketData is running.
+    bool replying;
+
+    enum Result { OK, ERROR, DONE };
+
+    bool rateMatches();
+    double byteTime();
+    void send(const std::string &data, unsigned long delay = 0);
+    void commandLine(const std::string &line);
+    Result command(const std::string &command, std::string &reply);
+    Result smsCommand(const std::string &command, std::string &reply);
+    Result gprsCommand(const std::string &command, std::string &reply);
+    void payloadByte(char c);
+    std::string encode(const std::string &text);
+    std::string listEntry(int index, const A6simSMS &sms, bool list);
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "A6test.h"
+
+struct A6testEntry {
+    const char *name;
+    A6testFunction function;
+};
+
+static std::vector<A6testEntry> &A6testRegistry() {
+    static std::vector<A6testEntry> registry;
+    return registry;
+}
+
+static int failures;
+
+
+A6testCase::A6testCase(const char *name, A6testFunction function) {
+    A6testEntry entry = { name, function };
+    A6testRegistry().push_back(entry);
+}
+
+
+void A6testFail(const char *file, int line, const std::string &message) {
+    printf("  %s:%d: %s\n", file, line, message.c_str());
+    failures++;
+}
+
+
+std::string A6testFormat(long value) {
+    return std::to_string(value);
+}
+
+
+std::string A6testFormat(unsigned long value) {
+    return std::to_string(value);
+}
+
+
+std::string A6testFormat(int value) {
+    return std::to_string(value);
+}
+
+
+std::string A6testFormat(unsigned int value) {
+    return std::to_string(value);
+}
+
+
+std::string A6testFormat(const char *value) {
+    return value != NULL ? "\"" + std::string(value) + "\"" : "NULL";
+}
+
+
+std::string A6testFormat(const std::string &value) {
+    return "\"" + value + "\"";
+}
+
+
+std::string A6testFormat(const String &value) {
+    return A6testFormat(value.c_str());
+}
+
+
+std::string A6testCommands(const A6sim &sim, size_t first) {
+    std::string joined;
+
+    for (size_t i = first; i < sim.commands.size(); i++) {
+        joined += (i > first ? "|" : "") + sim.commands[i];
+    }
+    return joined;
+}
+
+
+// Run every test, or the ones whose names contain the argument.
+int main(int argc, char **argv) {
+    int failed = 0;
+    int run = 0;
+
+    for (size_t i = 0; i < A6testRegistry().size(); i++) {
+        const A6testEntry &test = A6testRegistry()[i];
+        int before = failures;
+
+        if (argc > 1 && strstr(test.name, argv[1]) == NULL) {
+            continue;
+        }
+        A6shimReset();
+        test.function();
+        run++;
+        if (failures > before) {
+            printf("FAIL %s\n", test.name);
+            failed++;
+        }
+    }
+    printf("%d tests, %d failed\n", run, failed);
+    return failed > 0 ? 1 : 0;
+}
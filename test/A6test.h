@@ -0,0 +1,69 @@
+#ifndef A6test_h
+#define A6test_h
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+#include "A6sim.h"
+
+// A minimal test framework. Tests are registered with TEST(name) and run by
+// main(), each from a fresh simulated clock. A failed CHECK is reported and
+// the test goes on, so one run shows every failure.
+
+typedef void (*A6testFunction)();
+
+struct A6testCase {
+    A6testCase(const char *name, A6testFunction function);
+};
+
+void A6testFail(const char *file, int line, const std::string &message);
+std::string A6testFormat(long value);
+std::string A6testFormat(unsigned long value);
+std::string A6testFormat(int value);
+std::string A6testFormat(unsigned int value);
+std::string A6testFormat(const char *value);
+std::string A6testFormat(const std::string &value);
+std::string A6testFormat(const String &value);
+
+#define TEST(name) \
+    static void name(); \
+    static A6testCase name##Case(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            A6testFail(__FILE__, __LINE__, #condition); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do { \
+        std::string a6Actual = A6testFormat(actual), a6Expected = A6testFormat(expected); \
+        if (a6Actual != a6Expected) { \
+            A6testFail(__FILE__, __LINE__, std::string(#actual) + " is " + a6Actual + ", expected " + a6Expected); \
+        } \
+    } while (0)
+
+// Poll until the modem is idle, or give up after ms of simulated time.
+template <class T> void A6testDrain(T &modem, unsigned long ms = 60000) {
+    unsigned long start = millis();
+
+    while (modem.busy() && millis() - start < ms) {
+        modem.poll();
+    }
+}
+
+// Poll for ms of simulated time.
+template <class T> void A6testPoll(T &modem, unsigned long ms) {
+    unsigned long start = millis();
+
+    while (millis() - start < ms) {
+        modem.poll();
+    }
+}
+
+// The commands sent from index first on, joined with "|".
+std::string A6testCommands(const A6sim &sim, size_t first = 0);
+
+#endif
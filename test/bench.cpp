@@ -0,0 +1,495 @@
+// Measures what the common operations cost against the simulated module: how
+// long they take (in simulated time, with a module that answers every command
+// after A6BENCH_LATENCY ms), how many bytes go each way, how many heap
+// allocations they make and how much CPU time the library uses for them.
+// Where an operation was made faster, it's also run the way the library did it
+// before (A6before), and the two are compared.
+//
+//     make bench
+
+#include <Arduino.h>
+#include <ctime>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "A6lib.h"
+#include "A6codec.h"
+#include "A6inbox.h"
+#include "A6parse.h"
+#include "A6sim.h"
+#include "A6before.h"
+
+#define A6BENCH_LATENCY 20
+#define A6BENCH_MESSAGES 50
+
+struct A6benchCounters {
+    unsigned long ms;
+    unsigned long bytesIn;
+    unsigned long bytesOut;
+    unsigned long allocations;
+    std::clock_t cpu;
+};
+
+// What a run cost on average.
+struct A6benchResult {
+    double ms;
+    double bytesOut;
+    double bytesIn;
+    double allocations;
+    double cpu;
+};
+
+static A6benchCounters A6benchNow(const A6sim &sim) {
+    A6benchCounters counters = { A6shimNow(), sim.bytesIn, sim.bytesOut, A6shimAllocations(), std::clock() };
+    return counters;
+}
+
+// Run operation iterations times and print what each run cost on average.
+template <class F> A6benchResult A6bench(const char *name, A6sim &sim, int iterations, F operation) {
+    A6benchCounters start = A6benchNow(sim);
+
+    for (int i = 0; i < iterations; i++) {
+        operation();
+    }
+
+    A6benchCounters end = A6benchNow(sim);
+    A6benchResult result = {
+        (double)(end.ms - start.ms) / iterations,
+        (double)(end.bytesIn - start.bytesIn) / iterations,
+        (double)(end.bytesOut - start.bytesOut) / iterations,
+        (double)(end.allocations - start.allocations) / iterations,
+        (double)(end.cpu - start.cpu) * 1000000 / CLOCKS_PER_SEC / iterations
+    };
+    printf("%-28s %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, result.ms, result.bytesOut, result.bytesIn, result.allocations, result.cpu);
+    return result;
+}
+
+
+static void A6benchSection(const char *title) {
+    printf("\n%s\n%-28s %9s %9s %9s %9s %9s\n", title, "", "ms", "bytes out", "bytes in", "allocs", "cpu us");
+}
+
+
+static void A6benchRatio(double before, double after) {
+    if (after > 0) {
+        printf(" %8.1fx", before / after);
+    } else {
+        printf(" %9s", before > 0 ? "all" : "-");
+    }
+}
+
+// Print how many times what the old way cost the new way costs, column by
+// column. "all" means the new way costs nothing at all.
+static void A6benchCompare(const A6benchResult &before, const A6benchResult &after) {
+    printf("%-28s", "  before / after");
+    A6benchRatio(before.ms, after.ms);
+    A6benchRatio(before.bytesOut, after.bytesOut);
+    A6benchRatio(before.bytesIn, after.bytesIn);
+    A6benchRatio(before.allocations, after.allocations);
+    A6benchRatio(before.cpu, after.cpu);
+    printf("\n");
+}
+
+
+// Print a rate, such as bytes per CPU second, before and after.
+static void A6benchRate(const char *what, double before, double after) {
+    printf("%-28s %9.0f %9.0f %8.1fx\n", what, before, after, before > 0 ? after / before : 0);
+}
+
+
+static void A6benchDrain(A6lib &modem) {
+    while (modem.busy()) {
+        modem.poll();
+    }
+}
+
+
+static void A6benchIgnoreLine(const char *line, void *context) {
+}
+
+
+static void A6benchFillStore(A6sim &sim) {
+    A6shimNoCount noCount;
+
+    sim.store.clear();
+    for (int i = 1; i <= A6BENCH_MESSAGES; i++) {
+        A6simSMS sms = { "REC READ", "+306912345678", "17/01/01,10:00:00+08", "Message number " + std::to_string(i) + ", a fairly ordinary text." };
+        sim.store[i] = sms;
+    }
+}
+
+
+// begin() used to send its eight settings one at a time; now they go in as
+// few command lines as the modem takes. Finding the rate is left out of both.
+static void A6benchStartup(A6sim &sim, A6lib &modem, A6before &before) {
+    const char *settings[] = {
+        "AT&F", "ATE0", "AT+SNFS=0", "AT+CLIP=1", "AT+CMGF=1", "AT+CNMI=1,0", "AT+CPMS=ME,ME,ME", "AT+CSCS=\"UCS2\""
+    };
+    int count = sizeof(settings) / sizeof(settings[0]);
+    byte results[sizeof(settings) / sizeof(settings[0])];
+
+    A6benchSection("Setting the modem up in begin()");
+    A6benchResult old = A6bench("before", sim, 20, [&]() {
+        before.configure();
+    });
+    A6benchCompare(old, A6bench("after", sim, 20, [&]() {
+        modem.runBatch(settings, count, results);
+    }));
+}
+
+
+// The old receive path appended everything that came in to a String and
+// searched all of it for the responses; the new one splits it into lines in a
+// fixed buffer as it arrives.
+static void A6benchReceive(A6sim &sim, A6lib &modem, A6before &before) {
+    String response;
+
+    A6benchSection("Receiving a 50-message listing (AT+CMGL)");
+    A6benchResult old = A6bench("before", sim, 20, [&]() {
+        before.A6command("AT+CMGL=\"ALL\"", "\r\nOK\r\n", "yy", A6_SMS_TIMEOUT, 1, &response);
+    });
+    A6benchResult now = A6bench("after", sim, 20, [&]() {
+        modem.submit("AT+CMGL=\"ALL\"", "OK", "yy", A6_SMS_TIMEOUT, 1, NULL, A6benchIgnoreLine, NULL);
+        A6benchDrain(modem);
+    });
+    A6benchCompare(old, now);
+    printf("%-28s %9s %9s\n", "", "before", "after");
+    A6benchRate("bytes in per CPU second", old.bytesIn * 1000000 / old.cpu, now.bytesIn * 1000000 / now.cpu);
+}
+
+
+// The old listing parser made a String out of every seven bytes of the reply
+// to look for +CMGL:, and reading the messages took another AT+CMGR each; the
+// new one reads them all from the listing as it arrives.
+static void A6benchListing(A6sim &sim, A6lib &modem, A6before &before, SMSrecord *records) {
+    int locs[A6BENCH_MESSAGES];
+
+    A6benchSection("Listing 50 messages (getSMSLocs)");
+    A6benchResult old = A6bench("before", sim, 20, [&]() {
+        before.getSMSLocsOfType(locs, A6BENCH_MESSAGES, "ALL");
+    });
+    A6benchCompare(old, A6bench("after", sim, 20, [&]() {
+        modem.getSMSLocs(locs, A6BENCH_MESSAGES);
+    }));
+
+    // The old parser's 50-byte buffers don't hold a number in UCS2 hex.
+    modem.setSMScharset("IRA");
+    A6benchSection("Reading 50 messages (1 + 50 AT+CMGR vs readSMSList)");
+    old = A6bench("before", sim, 5, [&]() {
+        int count = before.getSMSLocsOfType(locs, A6BENCH_MESSAGES, "ALL");
+        for (int i = 0; i < count; i++) {
+            before.readSMS(locs[i]);
+        }
+    });
+    A6benchCompare(old, A6bench("after", sim, 5, [&]() {
+        modem.readSMSList(records, A6BENCH_MESSAGES, "ALL");
+    }));
+    modem.setSMScharset("UCS2");
+}
+
+
+#define A6BENCH_PARSES 100000
+
+// The old parsers interpreted a sscanf() format string for every reply and
+// copied each field through a 200-byte buffer; A6parse() is put together for
+// each reply shape at compile time.
+static void A6benchParsing(A6sim &sim) {
+    const char *clcc = "+CLCC: 1,1,4,0,0,\"+306912345678\",145";
+    const char *csq = "+CSQ: 23,99";
+    const char *cmgr = "+CMGR: \"REC READ\",\"+306912345678\",,\"17/01/01,10:00:00+08\"";
+    int index, direction, state, mode, multiparty, type, strength, error;
+    char number[50], date[50], status[12];
+    int fields = 0;
+
+    A6benchSection("Parsing +CLCC, 100000 times");
+    A6benchResult old = A6bench("before", sim, 1, [&]() {
+        for (int i = 0; i < A6BENCH_PARSES; i++) {
+            fields += A6beforeSscanf(clcc, "+CLCC: %d,%d,%d,%d,%d,\"%s\",%d", &index, &direction, &state, &mode, &multiparty, number, &type);
+        }
+    });
+    A6benchCompare(old, A6bench("after", sim, 1, [&]() {
+        for (int i = 0; i < A6BENCH_PARSES; i++) {
+            fields += A6parse(clcc, "+CLCC:", A6int(index), A6int(direction), A6int(state), A6int(mode), A6int(multiparty), A6text(number), A6int(type));
+        }
+    }));
+
+    A6benchSection("Parsing +CSQ, 100000 times");
+    old = A6bench("before", sim, 1, [&]() {
+        for (int i = 0; i < A6BENCH_PARSES; i++) {
+            fields += A6beforeSscanf(csq, "+CSQ: %d,%d", &strength, &error);
+        }
+    });
+    A6benchCompare(old, A6bench("after", sim, 1, [&]() {
+        for (int i = 0; i < A6BENCH_PARSES; i++) {
+            fields += A6parse(csq, "+CSQ:", A6int(strength), A6int(error));
+        }
+    }));
+
+    A6benchSection("Parsing +CMGR, 100000 times");
+    old = A6bench("before", sim, 1, [&]() {
+        for (int i = 0; i < A6BENCH_PARSES; i++) {
+            fields += A6beforeSscanf(cmgr, "+CMGR: \"REC %s\",\"%s\",,\"%s\"\r\n", status, number, date);
+        }
+    });
+    A6benchCompare(old, A6bench("after", sim, 1, [&]() {
+        for (int i = 0; i < A6BENCH_PARSES; i++) {
+            fields += A6parse(cmgr, "+CMGR:", A6text(status), A6text(number), A6skip(), A6text(date));
+        }
+    }));
+
+    // Use the results, so that the parsing isn't optimised away.
+    if (fields == 0) {
+        printf("%s %s %s\n", number, date, status);
+    }
+}
+
+
+#define A6BENCH_BURST 20
+
+static void A6benchSMSSent(byte result, int reference, void *context) {
+    (*(int *)context)++;
+}
+
+// The old sendSMS() wrote the text a fixed 100 ms after the prompt and didn't
+// wait to hear whether the message was sent; queueSMS() sends the next message
+// as soon as the modem has accepted the last one.
+static void A6benchBurst(A6sim &sim, A6lib &modem, A6before &before) {
+    const char *text = "Pump 3 has stopped.";
+    size_t sentBefore;
+
+    A6benchSection("Sending a burst of 20 messages");
+    sentBefore = sim.sent.size();
+    A6benchResult old = A6bench("before", sim, 1, [&]() {
+        for (int i = 0; i < A6BENCH_BURST; i++) {
+            before.sendSMS("+306912345678", text);
+        }
+    });
+    int oldSent = sim.sent.size() - sentBefore;
+    // Get rid of the replies it didn't wait for.
+    delay(2 * A6BENCH_LATENCY);
+    while (sim.available()) {
+        sim.read();
+    }
+
+    int confirmed = 0;
+    sentBefore = sim.sent.size();
+    A6benchResult now = A6bench("after", sim, 1, [&]() {
+        int queued = 0;
+        while (confirmed < A6BENCH_BURST) {
+            if (queued < A6BENCH_BURST && modem.queueSMS("+306912345678", text, A6benchSMSSent, &confirmed) == A6_OK) {
+                queued++;
+            }
+            modem.poll();
+        }
+        // Switching back to text mode is still to come.
+        A6benchDrain(modem);
+    });
+    A6benchCompare(old, now);
+    printf("%-28s %9s %9s\n", "", "before", "after");
+    A6benchRate("messages per second", A6BENCH_BURST * 1000 / old.ms, A6BENCH_BURST * 1000 / now.ms);
+    printf("%-28s %9d %9d\n", "messages sent", oldSent, (int)(sim.sent.size() - sentBefore));
+    printf("%-28s %9d %9d\n", "messages confirmed", 0, confirmed);
+}
+
+
+// How sketches turned UCS2 hex into text before the library could do it, a
+// character at a time with String.
+static String A6benchDecodeBefore(const String &hex) {
+    String text = "";
+
+    for (unsigned int i = 0; i + 4 <= hex.length(); i += 4) {
+        long c = strtol(hex.substring(i, i + 4).c_str(), NULL, 16);
+        if (c < 0x80) {
+            text += (char)c;
+        } else if (c < 0x800) {
+            text += (char)(0xc0 | (c >> 6));
+            text += (char)(0x80 | (c & 0x3f));
+        } else {
+            text += (char)(0xe0 | (c >> 12));
+            text += (char)(0x80 | ((c >> 6) & 0x3f));
+            text += (char)(0x80 | (c & 0x3f));
+        }
+    }
+    return text;
+}
+
+// Decoding the text of a full inbox of UCS2 messages, half of them in Greek.
+static void A6benchDecoding(A6sim &sim) {
+    std::vector<std::string> inbox;
+    String hex[A6BENCH_MESSAGES];
+    char buffer[A6_MESSAGE_SIZE];
+    size_t total = 0;
+    size_t decoded = 0;
+
+    {
+        A6shimNoCount noCount;
+        for (int i = 0; i < A6BENCH_MESSAGES; i++) {
+            std::string text = i % 2 ? "Message number " + std::to_string(i) + ", a fairly ordinary text." : "\u0397 \u03b1\u03bd\u03c4\u03bb\u03af\u03b1 " + std::to_string(i) + " \u03c3\u03c4\u03b1\u03bc\u03ac\u03c4\u03b7\u03c3\u03b5.";
+            const char *p = text.c_str();
+            std::string encoded;
+            unsigned long c;
+            while ((c = A6utf8Next(&p)) != 0) {
+                char unit[5];
+                snprintf(unit, sizeof(unit), "%04X", (unsigned)(c & 0xffff));
+                encoded += unit;
+            }
+            inbox.push_back(encoded);
+            hex[i] = encoded.c_str();
+            total += encoded.size();
+        }
+    }
+
+    A6benchSection("Decoding 50 UCS2 messages");
+    A6benchResult old = A6bench("before", sim, 100, [&]() {
+        for (int i = 0; i < A6BENCH_MESSAGES; i++) {
+            decoded += A6benchDecodeBefore(hex[i]).length();
+        }
+    });
+    A6benchResult now = A6bench("after", sim, 100, [&]() {
+        for (int i = 0; i < A6BENCH_MESSAGES; i++) {
+            strcpy(buffer, inbox[i].c_str());
+            A6decodeUCS2(buffer);
+            decoded += strlen(buffer);
+        }
+    });
+    A6benchCompare(old, now);
+    printf("%-28s %9s %9s\n", "", "before", "after");
+    A6benchRate("hex bytes per CPU ms", total * 1000 / old.cpu, total * 1000 / now.cpu);
+
+    // Use the results, so that the decoding isn't optimised away.
+    if (decoded == 0) {
+        printf("%s\n", buffer);
+    }
+}
+
+
+// Look for the end of a listing of this many messages, received in pieces of
+// this many bytes, the way a serial port hands them over.
+#define A6BENCH_CHUNK 32
+
+// The old code searched the whole reply again every time more of it came in,
+// so the time it took grew with the square of the reply's length; the matcher
+// looks at each byte once.
+static void A6benchMatching(A6sim &sim, int messages) {
+    std::string transcript;
+    char title[64];
+
+    {
+        A6shimNoCount noCount;
+        for (int i = 1; i <= messages; i++) {
+            transcript += "+CMGL: " + std::to_string(i) + ",\"REC READ\",\"+306912345678\",,\"17/01/01,10:00:00+08\"\r\n";
+            transcript += "Message number " + std::to_string(i) + ", a fairly ordinary text.\r\n";
+        }
+        transcript += "\r\nOK\r\n";
+    }
+
+    snprintf(title, sizeof(title), "Finding OK after %d messages (%u bytes)", messages, (unsigned)transcript.size());
+    A6benchSection(title);
+    A6benchResult old = A6bench("before", sim, 20, [&]() {
+        String reply = "";
+        char chunk[A6BENCH_CHUNK + 1];
+        for (size_t i = 0; i < transcript.size(); i += A6BENCH_CHUNK) {
+            size_t length = transcript.copy(chunk, A6BENCH_CHUNK, i);
+            chunk[length] = 0;
+            reply += chunk;
+            if (reply.indexOf("\r\nOK\r\n") + reply.indexOf("yy") != -2) {
+                break;
+            }
+        }
+    });
+    A6benchResult now = A6bench("after", sim, 20, [&]() {
+        A6matcher resp1, resp2;
+        resp1.begin("\r\nOK\r\n");
+        resp2.begin("yy");
+        for (size_t i = 0; i < transcript.size(); i++) {
+            char c = transcript[i];
+            if (resp1.feed(c) | resp2.feed(c)) {
+                break;
+            }
+        }
+    });
+    A6benchCompare(old, now);
+    printf("%-28s %9s %9s\n", "", "before", "after");
+    A6benchRate("bytes per CPU second", transcript.size() * 1000000 / old.cpu, transcript.size() * 1000000 / now.cpu);
+}
+
+
+int main() {
+    A6sim sim;
+    A6lib modem(sim);
+    static SMSrecord records[A6BENCH_MESSAGES];
+    SMSrecord record;
+    callRecord call;
+    int locs[A6BENCH_MESSAGES];
+
+    A6shimReset();
+    sim.setLatency(A6BENCH_LATENCY);
+    printf("%-28s %9s %9s %9s %9s %9s\n", "per operation", "ms", "bytes out", "bytes in", "allocs", "cpu us");
+
+    A6bench("begin", sim, 20, [&]() {
+        modem.begin(115200);
+    });
+    A6bench("getSignalStrength", sim, 100, [&]() {
+        modem.getSignalStrength();
+    });
+    A6bench("checkCallStatus()", sim, 100, [&]() {
+        modem.checkCallStatus();
+    });
+    A6bench("checkCallStatus(record)", sim, 100, [&]() {
+        modem.checkCallStatus(&call);
+    });
+
+    A6benchFillStore(sim);
+    A6bench("readSMS(index)", sim, 100, [&]() {
+        modem.readSMS(7);
+    });
+    A6bench("readSMS(index, record)", sim, 100, [&]() {
+        modem.readSMS(7, &record);
+    });
+    A6bench("getSMSLocs, 50 messages", sim, 20, [&]() {
+        modem.getSMSLocs(locs, A6BENCH_MESSAGES);
+    });
+    A6bench("readSMSList, 50 messages", sim, 20, [&]() {
+        modem.readSMSList(records, A6BENCH_MESSAGES, "ALL");
+    });
+    A6inbox inbox(modem, records, A6BENCH_MESSAGES);
+    inbox.begin();
+    A6bench("inbox sync, 50 messages", sim, 20, [&]() {
+        inbox.sync();
+    });
+    A6bench("inbox update, 1 new message", sim, 20, [&]() {
+        inbox.remove(A6BENCH_MESSAGES);
+        {
+            A6shimNoCount noCount;
+            sim.receiveSMS("+306912345678", "Just arrived.");
+        }
+        unsigned long start = millis();
+        while (millis() - start < 2 * A6BENCH_LATENCY) {
+            modem.poll();
+        }
+        inbox.update();
+    });
+    A6bench("sendSMS", sim, 20, [&]() {
+        modem.sendSMS("+306912345678", "A fairly ordinary text message.");
+    });
+
+    A6before before(sim);
+    A6benchSection("A command round trip (AT)");
+    A6benchResult old = A6bench("before", sim, 100, [&]() {
+        before.A6command("AT", "OK", "yy", A6_CMD_TIMEOUT, 2, NULL);
+    });
+    A6benchCompare(old, A6bench("after", sim, 100, [&]() {
+        modem.submit("AT", "OK", "yy", A6_ADAPTIVE, 2, NULL, NULL);
+        A6benchDrain(modem);
+    }));
+    A6benchStartup(sim, modem, before);
+    A6benchReceive(sim, modem, before);
+    A6benchBurst(sim, modem, before);
+    A6benchMatching(sim, 10);
+    A6benchMatching(sim, 50);
+    A6benchMatching(sim, 200);
+    A6benchListing(sim, modem, before, records);
+    A6benchParsing(sim);
+    A6benchDecoding(sim);
+    return 0;
+}
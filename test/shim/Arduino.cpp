@@ -0,0 +1,467 @@
+#include <Arduino.h>
+#include <new>
+
+static unsigned long now;
+static unsigned int calls;
+static unsigned long allocations;
+static int noCount;
+
+HardwareSerial Serial;
+
+
+unsigned long millis() {
+    if (++calls % 16 == 0) {
+        now++;
+    }
+    return now;
+}
+
+
+void delay(unsigned long ms) {
+    now += ms;
+}
+
+
+void yield() {
+    now++;
+}
+
+
+void pinMode(int pin, int mode) {
+    (void)pin;
+    (void)mode;
+}
+
+
+void digitalWrite(int pin, int value) {
+    (void)pin;
+    (void)value;
+}
+
+
+long random(long max) {
+    return max > 0 ? rand() % max : 0;
+}
+
+
+long random(long min, long max) {
+    return min + random(max - min);
+}
+
+
+unsigned long A6shimNow() {
+    return now;
+}
+
+
+void A6shimAdvance(unsigned long ms) {
+    now += ms;
+}
+
+
+void A6shimReset() {
+    now = 0;
+    calls = 0;
+    allocations = 0;
+    srand(1);
+}
+
+
+unsigned long A6shimAllocations() {
+    return allocations;
+}
+
+
+A6shimNoCount::A6shimNoCount() {
+    noCount++;
+}
+
+
+A6shimNoCount::~A6shimNoCount() {
+    noCount--;
+}
+
+
+void *operator new(size_t size) {
+    void *p = malloc(size ? size : 1);
+
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    if (noCount == 0) {
+        allocations++;
+    }
+    return p;
+}
+
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+
+void operator delete(void *p, size_t size) noexcept {
+    (void)size;
+    free(p);
+}
+
+
+void operator delete[](void *p, size_t size) noexcept {
+    (void)size;
+    free(p);
+}
+
+
+/////////////////////////////////////////////
+// String
+//
+
+String::String() : buffer(NULL), capacity(0), len(0) {
+}
+
+
+String::String(const char *text) : buffer(NULL), capacity(0), len(0) {
+    *this = text;
+}
+
+
+String::String(const String &other) : buffer(NULL), capacity(0), len(0) {
+    *this = other;
+}
+
+
+String::String(String &&other) : buffer(other.buffer), capacity(other.capacity), len(other.len) {
+    other.buffer = NULL;
+    other.capacity = 0;
+    other.len = 0;
+}
+
+
+String::String(char c) : buffer(NULL), capacity(0), len(0) {
+    char text[2] = { c, 0 };
+    *this = text;
+}
+
+
+String::String(int value) : String((long)value) {
+}
+
+
+String::String(long value) : buffer(NULL), capacity(0), len(0) {
+    char text[24];
+    snprintf(text, sizeof(text), "%ld", value);
+    *this = text;
+}
+
+
+String::String(unsigned long value) : buffer(NULL), capacity(0), len(0) {
+    char text[24];
+    snprintf(text, sizeof(text), "%lu", value);
+    *this = text;
+}
+
+
+String::~String() {
+    delete[] buffer;
+}
+
+
+String &String::operator=(const String &other) {
+    if (this != &other) {
+        len = 0;
+        concat(other.c_str(), other.len);
+    }
+    return *this;
+}
+
+
+String &String::operator=(String &&other) {
+    if (this != &other) {
+        delete[] buffer;
+        buffer = other.buffer;
+        capacity = other.capacity;
+        len = other.len;
+        other.buffer = NULL;
+        other.capacity = 0;
+        other.len = 0;
+    }
+    return *this;
+}
+
+
+String &String::operator=(const char *text) {
+    len = 0;
+    if (text != NULL) {
+        concat(text, strlen(text));
+    }
+    return *this;
+}
+
+
+String &String::operator+=(const String &other) {
+    concat(other.c_str(), other.len);
+    return *this;
+}
+
+
+String &String::operator+=(const char *text) {
+    concat(text, strlen(text));
+    return *this;
+}
+
+
+String &String::operator+=(char c) {
+    concat(&c, 1);
+    return *this;
+}
+
+
+bool String::operator==(const char *text) const {
+    return strcmp(c_str(), text) == 0;
+}
+
+
+bool String::operator==(const String &other) const {
+    return len == other.len && memcmp(c_str(), other.c_str(), len) == 0;
+}
+
+
+bool String::operator!=(const String &other) const {
+    return !(*this == other);
+}
+
+
+bool String::operator!=(const char *text) const {
+    return !(*this == text);
+}
+
+
+unsigned int String::length() const {
+    return len;
+}
+
+
+const char *String::c_str() const {
+    return buffer != NULL ? buffer : "";
+}
+
+
+// Grow the buffer to exactly size characters, as the Arduino String does.
+bool String::reserve(unsigned int size) {
+    if (buffer != NULL && capacity >= size) {
+        return true;
+    }
+
+    char *grown = new char[size + 1];
+    memcpy(grown, c_str(), len + 1);
+    delete[] buffer;
+    buffer = grown;
+    capacity = size;
+    return true;
+}
+
+
+void String::concat(const char *text, unsigned int length) {
+    if (length == 0 && buffer != NULL) {
+        buffer[len] = 0;
+        return;
+    }
+
+    // text may be part of this string.
+    if (buffer != NULL && text >= buffer && text < buffer + capacity) {
+        String copy(*this);
+        concat(copy.c_str() + (text - buffer), length);
+        return;
+    }
+
+    reserve(len + length);
+    memcpy(buffer + len, text, length);
+    len += length;
+    buffer[len] = 0;
+}
+
+
+char String::charAt(unsigned int index) const {
+    return index < len ? buffer[index] : 0;
+}
+
+
+void String::setCharAt(unsigned int index, char c) {
+    if (index < len) {
+        buffer[index] = c;
+    }
+}
+
+
+char &String::operator[](unsigned int index) {
+    static char dummy;
+
+    if (index >= len) {
+        dummy = 0;
+        return dummy;
+    }
+    return buffer[index];
+}
+
+
+void String::remove(unsigned int index) {
+    if (index < len) {
+        len = index;
+        buffer[len] = 0;
+    }
+}
+
+
+int String::indexOf(char c) const {
+    const char *found = strchr(c_str(), c);
+    return found != NULL ? found - c_str() : -1;
+}
+
+
+int String::indexOf(const char *text) const {
+    const char *found = strstr(c_str(), text);
+    return found != NULL ? found - c_str() : -1;
+}
+
+
+int String::indexOf(const String &text) const {
+    return indexOf(text.c_str());
+}
+
+
+String String::substring(unsigned int from) const {
+    return substring(from, len);
+}
+
+
+String String::substring(unsigned int from, unsigned int to) const {
+    String result;
+
+    if (from > to) {
+        unsigned int swap = from;
+        from = to;
+        to = swap;
+    }
+    if (to > len) {
+        to = len;
+    }
+    if (from < to) {
+        result.concat(c_str() + from, to - from);
+    }
+    return result;
+}
+
+
+bool String::startsWith(const String &prefix) const {
+    return prefix.len <= len && memcmp(c_str(), prefix.c_str(), prefix.len) == 0;
+}
+
+
+bool String::endsWith(const String &suffix) const {
+    return suffix.len <= len && memcmp(c_str() + len - suffix.len, suffix.c_str(), suffix.len) == 0;
+}
+
+
+long String::toInt() const {
+    return atol(c_str());
+}
+
+
+/////////////////////////////////////////////
+// Print and Stream
+//
+
+size_t Print::write(const uint8_t *data, size_t length) {
+    size_t written = 0;
+
+    while (length-- > 0) {
+        written += write(*data++);
+    }
+    return written;
+}
+
+
+size_t Print::write(const char *text) {
+    return text != NULL ? write((const uint8_t *)text, strlen(text)) : 0;
+}
+
+
+size_t Print::write(const char *data, size_t length) {
+    return write((const uint8_t *)data, length);
+}
+
+
+size_t Print::print(const char *text) {
+    return write(text);
+}
+
+
+size_t Print::print(const String &text) {
+    return write(text.c_str(), text.length());
+}
+
+
+size_t Print::print(char c) {
+    return write((uint8_t)c);
+}
+
+
+size_t Print::print(int value, int base) {
+    return print((long)value, base);
+}
+
+
+size_t Print::print(unsigned int value, int base) {
+    return print((unsigned long)value, base);
+}
+
+
+size_t Print::print(long value, int base) {
+    char text[24];
+
+    snprintf(text, sizeof(text), base == 16 ? "%lX" : "%ld", value);
+    return write(text);
+}
+
+
+size_t Print::print(unsigned long value, int base) {
+    char text[24];
+
+    snprintf(text, sizeof(text), base == 16 ? "%lX" : "%lu", value);
+    return write(text);
+}
+
+
+size_t Print::println() {
+    return write("\r\n");
+}
+
+
+size_t Stream::readBytes(char *data, size_t length) {
+    size_t count = 0;
+
+    while (count < length && available() > 0) {
+        data[count++] = read();
+    }
+    return count;
+}
+
+
+String Stream::readString() {
+    String text;
+
+    while (available() > 0) {
+        text += (char)read();
+    }
+    return text;
+}
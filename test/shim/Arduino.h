@@ -0,0 +1,167 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+// Just enough of the Arduino core to build the library on a PC, for the tests
+// and benchmarks. Time is simulated: millis() moves on by 1 ms every 16 calls
+// (so busy-waiting loops make progress), and delay() and yield() move it on
+// too. Heap allocations are counted, so the tests can check that calls that
+// shouldn't allocate don't.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <type_traits>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define DEC 10
+
+unsigned long millis();
+void delay(unsigned long ms);
+void yield();
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+long random(long max);
+long random(long min, long max);
+
+template <class A, class B> typename std::common_type<A, B>::type min(A a, B b) {
+    return a < b ? a : b;
+}
+template <class A, class B> typename std::common_type<A, B>::type max(A a, B b) {
+    return a > b ? a : b;
+}
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+// The simulated time, without moving it on, and moving it on by hand.
+unsigned long A6shimNow();
+void A6shimAdvance(unsigned long ms);
+void A6shimReset();
+
+// Heap allocations (operator new) made since A6shimReset(), outside of
+// A6shimNoCount sections.
+unsigned long A6shimAllocations();
+
+// Allocations made while one of these exists aren't counted, e.g. those of the
+// simulated modem, which aren't the library's.
+struct A6shimNoCount {
+    A6shimNoCount();
+    ~A6shimNoCount();
+};
+
+
+// Like the Arduino String, every change in length goes through the heap.
+class String {
+public:
+    String();
+    String(const char *text);
+    String(const String &other);
+    String(String &&other);
+    explicit String(char c);
+    explicit String(int value);
+    explicit String(long value);
+    explicit String(unsigned long value);
+    ~String();
+
+    String &operator=(const String &other);
+    String &operator=(String &&other);
+    String &operator=(const char *text);
+    String &operator+=(const String &other);
+    String &operator+=(const char *text);
+    String &operator+=(char c);
+    bool operator==(const String &other) const;
+    bool operator==(const char *text) const;
+    bool operator!=(const String &other) const;
+    bool operator!=(const char *text) const;
+
+    unsigned int length() const;
+    const char *c_str() const;
+    bool reserve(unsigned int size);
+    void concat(const char *text, unsigned int length);
+    char charAt(unsigned int index) const;
+    void setCharAt(unsigned int index, char c);
+    char &operator[](unsigned int index);
+    void remove(unsigned int index);
+    int indexOf(char c) const;
+    int indexOf(const char *text) const;
+    int indexOf(const String &text) const;
+    String substring(unsigned int from) const;
+    String substring(unsigned int from, unsigned int to) const;
+    bool startsWith(const String &prefix) const;
+    bool endsWith(const String &suffix) const;
+    long toInt() const;
+
+private:
+    char *buffer;
+    unsigned int capacity;
+    unsigned int len;
+};
+
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *data, size_t length);
+    size_t write(const char *text);
+    size_t write(const char *data, size_t length);
+    virtual void flush() {}
+
+    size_t print(const char *text);
+    size_t print(const String &text);
+    size_t print(char c);
+    size_t print(int value, int base = DEC);
+    size_t print(unsigned int value, int base = DEC);
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t println();
+    template <class T> size_t println(T value) {
+        size_t written = print(value);
+        return written + println();
+    }
+};
+
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    void setTimeout(unsigned long timeout) {
+        (void)timeout;
+    }
+    size_t readBytes(char *data, size_t length);
+    String readString();
+};
+
+
+// Serial prints to stdout, and never receives anything.
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long rate) {
+        (void)rate;
+    }
+    int available() {
+        return 0;
+    }
+    int read() {
+        return -1;
+    }
+    int peek() {
+        return -1;
+    }
+    size_t write(uint8_t c) {
+        return fputc(c, stdout) == EOF ? 0 : 1;
+    }
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif
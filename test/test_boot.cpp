@@ -0,0 +1,107 @@
+#include "A6test.h"
+#include "A6lib.h"
+
+TEST(beginSendsSettingsInFewLines) {
+    A6sim sim;
+    A6lib modem(sim);
+
+    CHECK_EQ(modem.begin(9600), A6_OK);
+    CHECK_EQ(A6testCommands(sim), "AT|AT&FE0+SNFS=0;+CLIP=1;+CMGF=1;+CNMI=1,0;+CPMS=ME,ME,ME|AT+CSCS=\"UCS2\"");
+    CHECK(!sim.echo);
+    CHECK_EQ(sim.charset, "UCS2");
+}
+
+
+TEST(beginFailsWhenStorageFails) {
+    A6sim sim;
+    A6lib modem(sim);
+
+    sim.storageFails = true;
+    CHECK_EQ(modem.begin(9600), A6_FAILURE);
+    // The batch is split up to find out which setting failed.
+    CHECK(A6testCommands(sim).find("|AT+CPMS=ME,ME,ME|") != std::string::npos);
+}
+
+
+static long storedRate;
+static int rateSaves;
+
+static long A6testLoadRate(void *context) {
+    (void)context;
+    return storedRate;
+}
+
+static void A6testSaveRate(long rate, void *context) {
+    (void)context;
+    storedRate = rate;
+    rateSaves++;
+}
+
+
+TEST(rateIsDetectedAndRemembered) {
+    A6sim sim;
+    A6lib modem(sim);
+
+    storedRate = 0;
+    rateSaves = 0;
+    sim.fixedRate = 57600;
+    modem.setRateStore(A6testLoadRate, A6testSaveRate, NULL);
+    CHECK_EQ(modem.begin(115200), A6_OK);
+    CHECK_EQ(sim.fixedRate, 115200L);
+    CHECK_EQ(sim.rate, 115200L);
+    CHECK_EQ(storedRate, 115200L);
+    CHECK_EQ(rateSaves, 1);
+
+    // Now the module is found at the first try, and the rate isn't saved
+    // again.
+    unsigned long start = millis();
+    CHECK_EQ(modem.begin(115200), A6_OK);
+    CHECK(millis() - start < 100);
+    CHECK_EQ(rateSaves, 1);
+
+    // As it is by another instance, from the store.
+    A6lib other(sim);
+    other.setRateStore(A6testLoadRate, A6testSaveRate, NULL);
+    size_t first = sim.commands.size();
+    CHECK_EQ(other.begin(115200), A6_OK);
+    CHECK_EQ(sim.commands[first], "AT");
+    CHECK_EQ(rateSaves, 1);
+}
+
+
+TEST(beginFailsWithoutModule) {
+    A6sim sim;
+    A6lib modem(sim);
+
+    // A rate that isn't tried.
+    sim.fixedRate = 1200;
+    CHECK_EQ(modem.begin(9600), A6_NOTOK);
+}
+
+
+TEST(readinessIsDetected) {
+    A6sim sim;
+    A6lib modem(sim);
+    int probes = 0;
+
+    sim.onCommand = [&sim, &probes](const std::string &command, std::string &reply) {
+        (void)reply;
+        if (command == "+CREG?" && ++probes == 4) {
+            sim.registration = 1;
+        }
+        return false;
+    };
+    sim.registration = 2;
+    CHECK_EQ(modem.powerCycle(3), A6_OK);
+    CHECK_EQ(probes, 4);
+    CHECK(modem.getBootLatency() > 1000);
+    CHECK(modem.getBootLatency() < 5000);
+
+    // "Call Ready" is enough, without waiting for a probe.
+    sim.registration = 2;
+    sim.inject("\r\nCall Ready\r\n");
+    CHECK_EQ(modem.waitUntilReady(5000), A6_OK);
+    CHECK(modem.getBootLatency() < 50);
+
+    CHECK_EQ(modem.waitUntilReady(1000), A6_TIMEOUT);
+}
@@ -0,0 +1,85 @@
+#include "A6test.h"
+#include "A6lib.h"
+
+TEST(callsCanBeMadeAndChecked) {
+    A6sim sim;
+    A6lib modem(sim);
+    callRecord call;
+
+    CHECK_EQ(modem.checkCallStatus(&call), A6_NOTOK);
+
+    modem.dial("+301234");
+    CHECK_EQ(sim.callState(), 2);
+    CHECK_EQ(modem.checkCallStatus(&call), A6_OK);
+    CHECK_EQ(call.direction, DIR_OUTGOING);
+    CHECK_EQ(call.state, CALL_DIALING);
+    CHECK_EQ(call.number, "+301234");
+
+    sim.answerCall();
+    callInfo info = modem.checkCallStatus();
+    CHECK_EQ(info.state, CALL_ACTIVE);
+    CHECK_EQ(info.number, "+301234");
+
+    modem.hangUp();
+    CHECK_EQ(sim.callState(), A6SIM_IDLE);
+    modem.redial();
+    CHECK_EQ(sim.callState(), 2);
+    CHECK_EQ(A6testCommands(sim), "AT+CLCC|ATD+301234;|AT+CLCC|AT+CLCC|ATH|AT+DLST");
+}
+
+
+TEST(incomingCallsCanBeAnswered) {
+    A6sim sim;
+    A6lib modem(sim);
+    callRecord call;
+
+    sim.ring("+305678");
+    CHECK_EQ(modem.checkCallStatus(&call), A6_OK);
+    CHECK_EQ(call.direction, DIR_INCOMING);
+    CHECK_EQ(call.state, CALL_INCOMING);
+    modem.answer();
+    CHECK_EQ(sim.callState(), 0);
+}
+
+
+TEST(statusQueries) {
+    A6sim sim;
+    A6lib modem(sim);
+    char time[A6_DATE_SIZE];
+
+    sim.signal = 31;
+    CHECK_EQ(modem.getSignalStrength(), 100);
+    CHECK_EQ(modem.getRealTimeClock(time, sizeof(time)), A6_OK);
+    CHECK_EQ(time, "17/01/01,10:00:00+08");
+    CHECK_EQ(modem.getRealTimeClock(), "17/01/01,10:00:00+08");
+
+    modem.setVol(6);
+    modem.enableSpeaker(1);
+    CHECK_EQ(A6testCommands(sim, 3), "AT+CLVL=6|AT+SNFS=1");
+}
+
+
+TEST(queriesEndWithTheirReply) {
+    A6sim sim;
+    A6lib modem(sim);
+    char time[A6_DATE_SIZE];
+    callRecord call;
+
+    // At 9600 baud, the OK after the reply line takes a while to come in,
+    // and it belongs to the query, not to the next command.
+    sim.begin(9600);
+    sim.signal = 31;
+    sim.ring("+30123");
+    A6testPoll(modem, 100);
+    size_t first = sim.commands.size();
+    CHECK_EQ(modem.getSignalStrength(), 100);
+    CHECK_EQ(modem.setSMScharset("BOGUS"), A6_NOTOK);
+    CHECK_EQ(modem.checkCallStatus(&call), A6_OK);
+    CHECK_EQ(call.number, "+30123");
+    CHECK_EQ(modem.setSMScharset("GSM"), A6_OK);
+    CHECK_EQ(modem.getRealTimeClock(time, sizeof(time)), A6_OK);
+    CHECK_EQ(time, "17/01/01,10:00:00+08");
+    CHECK_EQ(modem.setSMScharset("BOGUS"), A6_NOTOK);
+    // Errors are repeated once.
+    CHECK_EQ(A6testCommands(sim, first), "AT+CSQ|AT+CSCS=\"BOGUS\"|AT+CSCS=\"BOGUS\"|AT+CLCC|AT+CSCS=\"GSM\"|AT+CCLK?|AT+CSCS=\"BOGUS\"|AT+CSCS=\"BOGUS\"");
+}
@@ -0,0 +1,309 @@
+#include "A6test.h"
+#include "A6lib.h"
+
+struct A6testResult {
+    int calls;
+    byte result;
+    std::string response;
+};
+
+static void A6testDone(byte result, const char *response, void *context) {
+    A6testResult *done = (A6testResult *)context;
+
+    done->calls++;
+    done->result = result;
+    done->response = response;
+}
+
+
+TEST(submitCompletesInOrder) {
+    A6sim sim;
+    A6lib modem(sim);
+    A6testResult clock = {}, ok = {};
+
+    CHECK_EQ(modem.submit("AT+CCLK?", "OK", "yy", 2000, 2, A6testDone, &clock), A6_OK);
+    CHECK_EQ(modem.submit("AT", "OK", "yy", 2000, 2, A6testDone, &ok), A6_OK);
+    CHECK(modem.busy());
+    A6testDrain(modem);
+
+    CHECK(!modem.busy());
+    CHECK_EQ(clock.calls, 1);
+    CHECK_EQ(clock.result, A6_OK);
+    CHECK(clock.response.find("+CCLK: \"17/01/01,10:00:00+08\"") != std::string::npos);
+    CHECK_EQ(ok.result, A6_OK);
+    CHECK_EQ(A6testCommands(sim), "AT+CCLK?|AT");
+}
+
+
+TEST(submitRetriesAndTimesOut) {
+    A6sim sim;
+    A6lib modem(sim);
+    A6testResult lost = {}, after = {};
+
+    sim.dropReplies(5);
+    modem.submit("AT+CSQ", "OK", "yy", 500, 2, A6testDone, &lost);
+    A6testDrain(modem);
+    CHECK_EQ(lost.result, A6_TIMEOUT);
+    CHECK_EQ(A6testCommands(sim), "AT+CSQ|AT+CSQ");
+
+    sim.dropReplies(1);
+    modem.submit("AT+CSQ", "OK", "yy", 500, 2, A6testDone, &after);
+    A6testDrain(modem);
+    CHECK_EQ(after.result, A6_OK);
+#if A6_METRICS_SLOTS > 0
+    CHECK_EQ(modem.getMetrics().commands[0].timeouts, 1UL);
+    CHECK_EQ(modem.getMetrics().commands[0].retries, 2UL);
+#endif
+}
+
+
+TEST(errorsAreReported) {
+    A6sim sim;
+    A6lib modem(sim);
+    A6testResult error = {}, cms = {};
+
+    sim.onCommand = [](const std::string &command, std::string &reply) {
+        if (command == "+CMGR=9") {
+            reply = "\r\n+CMS ERROR: 500\r\n";
+            return true;
+        }
+        return false;
+    };
+    modem.submit("AT+NOPE", "OK", "yy", 500, 2, A6testDone, &error);
+    modem.submit("AT+CMGR=9", "OK", "yy", 500, 1, A6testDone, &cms);
+    A6testDrain(modem);
+
+    CHECK_EQ(error.result, A6_NOTOK);
+    CHECK_EQ(cms.result, A6_CMS_ERROR);
+    CHECK_EQ(modem.getLastError(), 500);
+    // ERROR is repeated, the failed commands aren't.
+    CHECK_EQ(A6testCommands(sim), "AT+NOPE|AT+NOPE|AT+CMGR=9");
+}
+
+
+TEST(patternsMatchAcrossPartialMatches) {
+    A6sim sim;
+    A6lib modem(sim);
+    A6testResult done = {};
+
+    sim.onCommand = [](const std::string &command, std::string &reply) {
+        reply = "\r\nAAAAAB\r\nOK\r\n";
+        return command == "+AAB";
+    };
+    modem.submit("AT+AAB", "AAAB", "yy", 500, 1, A6testDone, &done);
+    A6testDrain(modem);
+    CHECK_EQ(done.result, A6_OK);
+}
+
+
+static std::string urcLines;
+
+static void A6testURC(const char *line, void *context) {
+    urcLines += std::string((const char *)context) + "[" + line + "]";
+}
+
+
+TEST(unsolicitedLinesGoToHandlers) {
+    A6sim sim;
+    A6lib modem(sim);
+    A6testResult done = {};
+
+    urcLines.clear();
+    modem.onUnsolicited("+CMTI:", A6testURC, (void *)"sms");
+    modem.onUnsolicited("+CREG:", A6testURC, (void *)"creg");
+    modem.onUnsolicited("RING", A6testURC, (void *)"ring");
+    sim.inject("\r\nRING\r\n\r\n+CREG: 5\r\n");
+    A6testPoll(modem, 10);
+    CHECK_EQ(urcLines, "ring[RING]creg[+CREG: 5]");
+
+    // The reply to AT+CREG? is left to the command, an unrelated line in the
+    // middle of it isn't.
+    urcLines.clear();
+    sim.onCommand = [](const std::string &command, std::string &reply) {
+        reply = "\r\n+CMTI: \"ME\",3\r\n\r\n+CREG: 1,1\r\n\r\nOK\r\n";
+        return command == "+CREG?";
+    };
+    modem.submit("AT+CREG?", "OK", "yy", 2000, 1, A6testDone, &done);
+    A6testDrain(modem);
+    CHECK_EQ(urcLines, "sms[+CMTI: \"ME\",3]");
+    CHECK(done.response.find("+CREG: 1,1") != std::string::npos);
+
+    modem.removeUnsolicited("RING");
+    urcLines.clear();
+    sim.inject("\r\nRING\r\n");
+    A6testPoll(modem, 10);
+    CHECK_EQ(urcLines, "");
+}
+
+
+TEST(metricsCountCommandsAndBytes) {
+    A6sim sim;
+    A6lib modem(sim);
+
+    for (int i = 0; i < 5; i++) {
+        modem.getSignalStrength();
+    }
+    sim.dropReplies(2);
+    modem.deleteSMS(99);
+
+    const A6metrics &metrics = modem.getMetrics();
+#if A6_METRICS_SLOTS > 0
+    CHECK_EQ(metrics.commandCount, 2);
+    CHECK_EQ(metrics.commands[0].name, "+CSQ");
+    CHECK_EQ(metrics.commands[0].count, 5UL);
+    CHECK_EQ(metrics.commands[0].latency[0], 5UL);
+    CHECK_EQ(metrics.commands[1].name, "+CMGD");
+    CHECK_EQ(metrics.commands[1].timeouts, 1UL);
+#else
+    CHECK_EQ(metrics.commandCount, 0);
+#endif
+    CHECK_EQ(metrics.bytesSent, sim.bytesIn);
+    CHECK_EQ(metrics.bytesReceived, sim.bytesOut);
+
+    modem.resetMetrics();
+    CHECK_EQ(modem.getMetrics().commandCount, 0);
+    CHECK_EQ(modem.getMetrics().bytesSent, 0UL);
+
+    // Resetting with a command in flight, before it's retried.
+    sim.dropReplies(1);
+    modem.submit("AT+CCLK?", "OK", "yy", 500, 2, NULL, NULL);
+    A6testPoll(modem, 100);
+    modem.resetMetrics();
+    A6testDrain(modem);
+#if A6_METRICS_SLOTS > 0
+    CHECK_EQ(metrics.commandCount, 1);
+    CHECK_EQ(metrics.commands[0].name, "+CCLK");
+    CHECK_EQ(metrics.commands[0].count, 1UL);
+    CHECK_EQ(metrics.commands[0].retries, 1UL);
+#endif
+}
+
+
+TEST(urgentCommandsGoFirst) {
+    A6sim sim;
+    A6lib modem(sim);
+    A6testResult list = {}, signal1 = {}, calls = {}, read = {};
+
+    sim.setLatency("+CMGL", 500);
+    modem.submit("AT+CMGL=\"ALL\"", "OK", "yy", 2000, 1, A6testDone, &list);
+    modem.poll();
+    modem.submit("AT+CSQ", "OK", "yy", 2000, 1, A6testDone, &signal1);
+    // The same poll is coalesced with the one already waiting.
+    modem.submit("AT+CSQ", "OK", "yy", 2000, 1, A6testDone, &signal1);
+    modem.submit("AT+CLCC", "OK", "yy", 2000, 1, A6testDone, &calls);
+    modem.submit("AT+CMGR=1", "OK", "yy", 2000, 1, A6testDone, &read);
+    sim.ring("+301234");
+    modem.answer();
+    A6testDrain(modem);
+
+    CHECK_EQ(A6testCommands(sim), "AT+CMGL=\"ALL\"|ATA|AT+CMGR=1|AT+CSQ|AT+CLCC");
+    CHECK_EQ(sim.callState(), 0);
+    CHECK_EQ(signal1.calls, 1);
+    const A6metrics &metrics = modem.getMetrics();
+    CHECK_EQ(metrics.queues[A6_PRIORITY_URGENT].count, 1UL);
+    CHECK_EQ(metrics.queues[A6_PRIORITY_BACKGROUND].count, 2UL);
+    CHECK_EQ(metrics.queues[A6_PRIORITY_BACKGROUND].coalesced, 1UL);
+    CHECK(metrics.queues[A6_PRIORITY_URGENT].maxWait < metrics.queues[A6_PRIORITY_BACKGROUND].maxWait);
+}
+
+
+TEST(adaptiveTimeoutsLoseLessTime) {
+    unsigned long took[2];
+    int timeouts[2] = { A6_CMD_TIMEOUT, A6_ADAPTIVE };
+
+    for (int t = 0; t < 2; t++) {
+        A6sim sim;
+        A6lib modem(sim);
+        int n = 0;
+        A6testResult done = {};
+
+        sim.setLatency(20);
+        sim.onCommand = [&n](const std::string &command, std::string &reply) {
+            (void)command;
+            (void)reply;
+            // Lose every fifth reply.
+            if (++n % 5 == 0) {
+                reply = "";
+                return true;
+            }
+            return false;
+        };
+        unsigned long start = millis();
+        for (int i = 0; i < 50; i++) {
+            modem.submit("AT+CSQ", "OK", "yy", timeouts[t], 2, A6testDone, &done);
+            A6testDrain(modem);
+            CHECK_EQ(done.result, A6_OK);
+        }
+        took[t] = millis() - start;
+    }
+    CHECK(took[1] * 3 < took[0]);
+}
+
+
+static unsigned long A6testTimeoutTook(A6sim &sim, A6lib &modem, const char *command) {
+    unsigned long start = millis();
+
+    sim.dropReplies(1);
+    modem.submit(command, "OK", "yy", A6_ADAPTIVE, 1, NULL, NULL);
+    A6testDrain(modem);
+    return millis() - start;
+}
+
+TEST(learnedTimeoutsSurviveResetsAndStayApart) {
+    A6sim sim;
+    A6lib modem(sim);
+
+    sim.setLatency(20);
+    for (int i = 0; i < 10; i++) {
+        modem.submit("AT+CCLK?", "OK", "yy", A6_ADAPTIVE, 1, NULL, NULL);
+        A6testDrain(modem);
+    }
+    modem.resetMetrics();
+    // Learned, and kept to the minimum for +CCLK.
+    CHECK(A6testTimeoutTook(sim, modem, "AT+CCLK?") < 400);
+
+    // Commands that don't fit in the table aren't lumped together, but get
+    // the initial timeout.
+    char command[20];
+    sim.onCommand = [](const std::string &command, std::string &reply) {
+        if (command.compare(0, 2, "+X") == 0) {
+            reply = "\r\nOK\r\n";
+            return true;
+        }
+        return false;
+    };
+    for (int i = 0; i < A6_REPLY_TIME_SLOTS + 2; i++) {
+        sprintf(command, "AT+X%d", i);
+        modem.submit(command, "OK", "yy", A6_ADAPTIVE, 1, NULL, NULL);
+        A6testDrain(modem);
+    }
+    CHECK(A6testTimeoutTook(sim, modem, "AT+X0") < 600);
+    sprintf(command, "AT+X%d", A6_REPLY_TIME_SLOTS + 1);
+    CHECK(A6testTimeoutTook(sim, modem, command) >= A6_CMD_TIMEOUT);
+}
+
+
+#if A6_TRACE_LEVEL > 0
+class A6testPrint : public Print {
+public:
+    std::string text;
+    size_t write(uint8_t c) {
+        text += (char)c;
+        return 1;
+    }
+};
+
+
+TEST(traceNamesCommands) {
+    A6sim sim;
+    A6lib modem(sim);
+    A6testPrint out;
+
+    modem.getSignalStrength();
+    modem.resetMetrics();
+    modem.setSMScharset("GSM");
+    modem.printTrace(out);
+    CHECK(out.text.find("issuing command +CSQ\r\n") != std::string::npos);
+    CHECK(out.text.find("issuing command +CSCS\r\n") != std::string::npos);
+}
+#endif
@@ -0,0 +1,182 @@
+#include "A6test.h"
+#include "A6lib.h"
+#include "A6http.h"
+
+static std::string received[A6_MAX_SOCKETS];
+static int closedSocket;
+
+static void A6testSocketData(byte socket, const byte *data, size_t length, void *context) {
+    (void)context;
+    if (length == 0) {
+        closedSocket = socket;
+    } else {
+        received[socket].append((const char *)data, length);
+    }
+}
+
+TEST(longApnIsRefused) {
+    A6sim sim;
+    A6lib modem(sim);
+    std::string apn(A6_CMD_MAXLEN, 'a');
+
+    CHECK_EQ(modem.connectGPRS(apn.c_str()), A6_NOTOK);
+    CHECK_EQ(A6testCommands(sim), "");
+    CHECK_EQ(modem.connectGPRS("internet"), A6_OK);
+}
+
+
+TEST(socketsCarryBinaryData) {
+    A6sim sim;
+    A6lib modem(sim);
+    const char data[] = "GET / HTTP/1.0\r\n\r\n\0binary,+CIPRCV:9,9,\r\nOK\r\n";
+    std::string expected;
+
+    for (int i = 0; i < A6_MAX_SOCKETS; i++) {
+        received[i].clear();
+    }
+    closedSocket = -1;
+    sim.onSocketData = [](int socket, const std::string &data) {
+        (void)socket;
+        return data;
+    };
+    sim.unreachable.push_back("bad.example");
+
+    CHECK_EQ(modem.connectGPRS("internet"), A6_OK);
+    CHECK(modem.openSocket("bad.example", 80, A6testSocketData, NULL) < 0);
+    int socket = modem.openSocket("example.com", 80, A6testSocketData, NULL);
+    CHECK(socket >= 0);
+    for (int i = 0; i < 3; i++) {
+        CHECK_EQ(modem.sendSocket(socket, (const byte *)data, sizeof(data)), A6_OK);
+        expected.append(data, sizeof(data));
+    }
+    sim.inject("\r\nRING\r\n");
+    A6testPoll(modem, 500);
+    CHECK_EQ(received[socket], expected);
+
+    const A6socketStats &stats = modem.getSocketStats(socket);
+    CHECK_EQ(stats.bytesSent, (unsigned long)expected.size());
+    CHECK_EQ(stats.bytesReceived, (unsigned long)expected.size());
+    CHECK_EQ(stats.sends, 3UL);
+
+    sim.closeSocket(socket);
+    A6testPoll(modem, 100);
+    CHECK_EQ(closedSocket, socket);
+    CHECK(modem.sendSocket(socket, (const byte *)"x", 1) != A6_OK);
+
+    socket = modem.openSocket("example.com", 80, A6testSocketData, NULL);
+    CHECK(socket >= 0);
+    CHECK_EQ(modem.closeSocket(socket), A6_OK);
+}
+
+
+static std::string body;
+
+static void A6testBody(const byte *data, size_t length, void *context) {
+    (void)context;
+    body.append((const char *)data, length);
+}
+
+static void A6testWriteBody(Print &out, size_t offset, size_t length, void *context) {
+    (void)context;
+    for (size_t i = 0; i < length; i++) {
+        out.write('a' + (offset + i) % 26);
+    }
+}
+
+TEST(httpHandlesEveryKindOfBody) {
+    A6sim sim;
+    A6lib modem(sim);
+    A6http http(modem);
+    std::string request, big;
+    int mode = 0;
+
+    for (int i = 0; i < 3000; i++) {
+        big += (char)('0' + i % 10);
+    }
+    sim.onSocketData = [&](int socket, const std::string &data) -> std::string {
+        request += data;
+        size_t end = request.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            return "";
+        }
+        size_t length = 0;
+        size_t header = request.find("Content-Length: ");
+        if (header != std::string::npos && header < end) {
+            length = atoi(request.c_str() + header + 16);
+        }
+        if (request.size() < end + 4 + length) {
+            return "";
+        }
+        request.clear();
+        if (mode == 0) {
+            return "HTTP/1.1 200 OK\r\nContent-Length: 3000\r\n\r\n" + big;
+        }
+        if (mode == 1) {
+            std::string reply = "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 Created\r\nTransfer-Encoding: chunked\r\n\r\n";
+            for (size_t i = 0; i < big.size(); i += 700) {
+                char size[20];
+                std::string chunk = big.substr(i, 700);
+                sprintf(size, "%zx\r\n", chunk.size());
+                reply += size + chunk + "\r\n";
+            }
+            return reply + "0\r\n\r\n";
+        }
+        // An HTTP/1.0 body lasts until the server closes the connection.
+        sim.closeSocket(socket);
+        return "HTTP/1.0 200 OK\r\n\r\n" + big;
+    };
+
+    modem.connectGPRS("internet");
+    size_t first = sim.commands.size();
+    body.clear();
+    CHECK_EQ(http.get("example.com", 80, "/a", A6testBody, NULL), 200);
+    CHECK_EQ(body, big);
+
+    mode = 1;
+    body.clear();
+    CHECK_EQ(http.post("example.com", 80, "/b", "text/plain", 2500, A6testWriteBody, A6testBody, NULL), 201);
+    CHECK_EQ(body, big);
+
+    mode = 2;
+    body.clear();
+    CHECK_EQ(http.get("example.com", 80, "/c", A6testBody, NULL), 200);
+    CHECK_EQ(body, big);
+
+    // The connection is kept open until the server closes it.
+    mode = 0;
+    body.clear();
+    CHECK_EQ(http.get("example.com", 80, "/d", A6testBody, NULL), 200);
+    CHECK_EQ(body, big);
+
+    int connections = 0;
+    for (size_t i = first; i < sim.commands.size(); i++) {
+        connections += sim.commands[i].compare(0, 11, "AT+CIPSTART") == 0;
+    }
+    CHECK_EQ(connections, 2);
+}
+
+
+TEST(httpPostWithoutBodyHasLength) {
+    A6sim sim;
+    A6lib modem(sim);
+    A6http http(modem);
+    std::string request, header;
+
+    sim.onSocketData = [&](int socket, const std::string &data) -> std::string {
+        (void)socket;
+        request += data;
+        size_t end = request.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            return "";
+        }
+        header = request.substr(0, end + 4);
+        request.clear();
+        return "HTTP/1.1 204 No Content\r\n\r\n";
+    };
+
+    modem.connectGPRS("internet");
+    CHECK_EQ(http.post("example.com", 80, "/ping", NULL, 0, NULL, A6testBody, NULL), 204);
+    CHECK(header.find("\r\nContent-Length: 0\r\n") != std::string::npos);
+    CHECK_EQ(http.get("example.com", 80, "/ping", A6testBody, NULL), 204);
+    CHECK(header.find("Content-Length") == std::string::npos);
+}
@@ -0,0 +1,108 @@
+#include "A6test.h"
+#include "A6lib.h"
+#include "A6inbox.h"
+
+TEST(inboxFetchesOnlyNewMessages) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord slots[5];
+    A6inbox inbox(modem, slots, 5);
+
+    A6simSMS old = { "REC READ", "+301", "17/01/01,10:00:00+08", "old one" };
+    sim.store[1] = old;
+    CHECK_EQ(inbox.begin(), A6_OK);
+    CHECK_EQ(inbox.getCount(), 1);
+    CHECK_EQ(inbox.find(1)->message, "old one");
+
+    sim.receiveSMS("+302", "new two");
+    sim.receiveSMS("+303", "new three");
+    A6testPoll(modem, 100);
+    size_t first = sim.commands.size();
+    CHECK_EQ(inbox.update(), 2);
+    CHECK_EQ(A6testCommands(sim, first), "AT+CMGR=2|AT+CMGR=3");
+    CHECK_EQ(inbox.find(3)->message, "new three");
+    CHECK_EQ(inbox.update(), 0);
+}
+
+
+TEST(inboxRecoversFromFloods) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord slots[5];
+    A6inbox inbox(modem, slots, 5);
+
+    CHECK_EQ(inbox.begin(), A6_OK);
+    for (int i = 0; i < A6_INBOX_PENDING + 2; i++) {
+        sim.receiveSMS("+30", "flood");
+    }
+    A6testPoll(modem, 100);
+    // Too many to track one by one, so the unread ones are listed, as many
+    // as fit.
+    size_t first = sim.commands.size();
+    CHECK_EQ(inbox.update(), 5);
+    CHECK_EQ(A6testCommands(sim, first), "AT+CMGL=\"REC UNREAD\"");
+    CHECK_EQ(inbox.getCount(), 5);
+
+    CHECK_EQ(inbox.remove(slots[0].index), A6_OK);
+    CHECK_EQ(inbox.getCount(), 4);
+    CHECK_EQ(inbox.sync(), A6_OK);
+    CHECK_EQ(inbox.getCount(), 5);
+}
+
+
+TEST(inboxLeavesMessagesUnreadWhenFull) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord slots[2];
+    A6inbox inbox(modem, slots, 2);
+
+    CHECK_EQ(inbox.begin(), A6_OK);
+    sim.receiveSMS("+301", "one");
+    sim.receiveSMS("+302", "two");
+    A6testPoll(modem, 100);
+    CHECK_EQ(inbox.update(), 2);
+
+    for (int i = 0; i < A6_INBOX_PENDING + 2; i++) {
+        sim.receiveSMS("+30", "flood");
+    }
+    A6testPoll(modem, 100);
+    size_t first = sim.commands.size();
+    CHECK_EQ(inbox.update(), 0);
+    CHECK_EQ(A6testCommands(sim, first), "");
+    int unread = 0;
+    for (std::map<int, A6simSMS>::iterator it = sim.store.begin(); it != sim.store.end(); ++it) {
+        unread += it->second.status == "REC UNREAD";
+    }
+    CHECK_EQ(unread, A6_INBOX_PENDING + 2);
+
+    // Once there's room, they are picked up.
+    CHECK_EQ(inbox.remove(slots[0].index), A6_OK);
+    CHECK_EQ(inbox.update(), 1);
+    CHECK_EQ(inbox.getCount(), 2);
+    CHECK_EQ(inbox.get(1)->message, "flood");
+
+    // Including the ones that a listing with too little room marked read.
+    CHECK_EQ(inbox.remove(slots[1].index), A6_OK);
+    CHECK_EQ(inbox.update(), 1);
+    CHECK_EQ(inbox.getCount(), 2);
+}
+
+
+TEST(fullInboxStillFetchesOnlyNewMessages) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord slots[2];
+    A6inbox inbox(modem, slots, 2);
+
+    sim.receiveSMS("+301", "one");
+    sim.receiveSMS("+302", "two");
+    CHECK_EQ(inbox.begin(), A6_OK);
+    CHECK_EQ(inbox.getCount(), 2);
+
+    CHECK_EQ(inbox.remove(1), A6_OK);
+    sim.receiveSMS("+303", "three");
+    A6testPoll(modem, 100);
+    size_t first = sim.commands.size();
+    CHECK_EQ(inbox.update(), 1);
+    CHECK_EQ(A6testCommands(sim, first), "AT+CMGR=1");
+}
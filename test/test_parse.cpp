@@ -0,0 +1,112 @@
+#include "A6test.h"
+#include "A6codec.h"
+#include "A6parse.h"
+
+TEST(repliesAreParsed) {
+    int strength = 0, error = 0;
+    char time[24];
+    char number[8];
+    int direction = 0, type = 0;
+
+    CHECK_EQ(A6parse("+CSQ: 20,99", "+CSQ:", A6int(strength), A6int(error)), 2);
+    CHECK_EQ(strength, 20);
+    CHECK_EQ(error, 99);
+    CHECK_EQ(A6parse("+CCLK: \"17/01/01,10:00:00+08\"", "+CCLK:", A6text(time)), 1);
+    CHECK_EQ(time, "17/01/01,10:00:00+08");
+    CHECK_EQ(A6parse("+CCLK: \"17/01", "+CCLK:", A6text(time)), 0);
+    CHECK_EQ(A6parse("+CREG: 1", "+CSQ:", A6int(strength)), -1);
+
+    // Text is truncated to fit, and skipped fields may have quoted commas.
+    CHECK_EQ(A6parse("+CLCC: 1,0,\"a,b\",\"+1234567890\",145", "+CLCC:", A6int(direction), A6skip(), A6skip(), A6text(number), A6int(type)), 5);
+    CHECK_EQ(number, "+123456");
+    CHECK_EQ(type, 145);
+
+    // Numbers too big to fit saturate.
+    long big = 0;
+    CHECK_EQ(A6parse("+CMTI: 78007800780078007800780", "+CMTI:", A6int(big)), 1);
+    CHECK(big > 0);
+}
+
+
+TEST(parsingSurvivesGarbage) {
+    const char *alphabet = "+CLSQ:0123456789,\" -abc";
+
+    for (int i = 0; i < 200000; i++) {
+        std::string line = "+CLCC:";
+        int length = rand() % 40;
+        int a, b, c, d, e, f;
+        char number[8], status[3];
+
+        for (int j = 0; j < length; j++) {
+            line += alphabet[rand() % strlen(alphabet)];
+        }
+        int fields = A6parse(line.c_str(), "+CLCC:", A6int(a), A6int(b), A6int(c), A6int(d), A6int(e), A6text(number), A6skip(), A6text(status), A6int(f));
+        CHECK(fields >= 0 && fields <= 9);
+        CHECK(strlen(number) < sizeof(number) || fields < 6);
+    }
+}
+
+
+class A6testPrint : public Print {
+public:
+    std::string text;
+
+    size_t write(uint8_t c) {
+        text += (char)c;
+        return 1;
+    }
+    using Print::write;
+};
+
+static std::string A6testRoundTrip(const char *text) {
+    A6testPrint out;
+    char buffer[256];
+
+    A6writeUCS2(out, text);
+    strcpy(buffer, out.text.c_str());
+    if (!A6decodeUCS2(buffer)) {
+        return "not UCS2: " + out.text;
+    }
+    return buffer;
+}
+
+TEST(ucs2RoundTrips) {
+    A6testPrint out;
+    char text[32];
+
+    CHECK_EQ(A6testRoundTrip("plain ASCII"), "plain ASCII");
+    CHECK_EQ(A6testRoundTrip("Ελληνικά, кириллица, €"), "Ελληνικά, кириллица, €");
+    CHECK_EQ(A6testRoundTrip("😀 outside the BMP"), "😀 outside the BMP");
+
+    A6writeUCS2(out, "A€");
+    CHECK_EQ(out.text, "004120AC");
+
+    // Not hex, or not whole characters.
+    strcpy(text, "Hello");
+    CHECK(!A6decodeUCS2(text));
+    CHECK_EQ(text, "Hello");
+    strcpy(text, "00410");
+    CHECK(!A6decodeUCS2(text));
+    // A lone surrogate.
+    strcpy(text, "D83D0041");
+    CHECK(A6decodeUCS2(text));
+    CHECK_EQ(text, "\xEF\xBF\xBD" "A");
+}
+
+
+TEST(gsmAlphabet) {
+    byte septets[2];
+    const char *p = "a€ж";
+
+    CHECK_EQ(A6gsmLength(A6utf8Next(&p)), 1);
+    unsigned long euro = A6utf8Next(&p);
+    CHECK_EQ(A6gsmLength(euro), 2);
+    CHECK_EQ(A6gsmEncode(euro, septets), 2);
+    CHECK_EQ(septets[0], 0x1B);
+    CHECK_EQ(septets[1], 0x65);
+    CHECK_EQ(A6gsmLength(A6utf8Next(&p)), 0);
+    CHECK_EQ(A6utf8Next(&p), 0UL);
+
+    p = "\xC3";
+    CHECK_EQ(A6utf8Next(&p), 0xFFFDUL);
+}
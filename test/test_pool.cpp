@@ -0,0 +1,68 @@
+#include "A6test.h"
+#include "A6lib.h"
+#include "A6pool.h"
+
+static int succeeded, failed;
+
+static void A6testSent(byte result, int reference, void *context) {
+    (void)reference;
+    (void)context;
+    if (result == A6_OK) {
+        succeeded++;
+    } else {
+        failed++;
+    }
+}
+
+TEST(poolSpreadsMessagesAndAvoidsFailingModems) {
+    A6sim sims[3];
+    A6lib a(sims[0]), b(sims[1]), c(sims[2]);
+    A6pool pool;
+
+    succeeded = failed = 0;
+    sims[1].smsFailures = 1000;
+    CHECK_EQ(pool.add(a), A6_OK);
+    CHECK_EQ(pool.add(b), A6_OK);
+    CHECK_EQ(pool.add(c), A6_OK);
+    for (int i = 0; i < 12; i++) {
+        CHECK_EQ(pool.queueSMS("+30123", "hi", A6testSent, NULL), A6_OK);
+    }
+    A6lib *call = pool.dial("+3099");
+    CHECK(call != NULL);
+
+    unsigned long start = millis();
+    while (pool.getQueuedSMSCount() > 0 && millis() - start < 120000) {
+        pool.poll();
+    }
+    pool.hangUp(call);
+
+    CHECK_EQ(succeeded, 12);
+    CHECK_EQ(failed, 0);
+    CHECK_EQ(sims[1].sent.size(), 0UL);
+    CHECK_EQ(sims[0].sent.size() + sims[2].sent.size(), 12UL);
+    CHECK(pool.getModem(1).failed > 0);
+    CHECK(pool.getStats().moved > 0);
+    CHECK_EQ(pool.getStats().sent, 12UL);
+}
+
+
+TEST(poolNoticesCallsEnding) {
+    A6sim sim;
+    A6lib modem(sim);
+    A6pool pool;
+
+    CHECK_EQ(pool.add(modem), A6_OK);
+    CHECK(pool.dial("+3099") == &modem);
+    CHECK(pool.dial("+3098") == NULL);
+
+    // The other side hangs up.
+    sim.hangUpCall();
+    A6testPoll(pool, 100);
+    CHECK(pool.dial("+3099") == &modem);
+
+    sim.inject("\r\nBUSY\r\n");
+    A6testPoll(pool, 100);
+    CHECK(pool.dial("+3099") == &modem);
+    pool.hangUp(&modem);
+    CHECK(!pool.getModem(0).inCall);
+}
@@ -0,0 +1,479 @@
+#include "A6test.h"
+#include "A6lib.h"
+
+TEST(smsIsSentAsPDU) {
+    A6sim sim;
+    A6lib modem(sim);
+
+    CHECK_EQ(modem.sendSMS("46708251358", "hellohello"), A6_OK);
+    CHECK_EQ(sim.sent.size(), 1UL);
+    CHECK(sim.sent[0].pdu);
+    CHECK_EQ(sim.sent[0].header, "22");
+    CHECK_EQ(sim.sent[0].payload, "0001000B816407281553F800000AE8329BFD4697D9EC37");
+    // The modem is left in text mode.
+    CHECK(!sim.pduMode);
+    CHECK_EQ(A6testCommands(sim), "AT+CMGF=0|AT+CMGS=22|AT+CMGF=1");
+}
+
+
+TEST(longSmsIsSplitWithoutSplittingCharacters) {
+    A6sim sim;
+    A6lib modem(sim);
+    std::string text;
+
+    for (int i = 0; i < 200; i++) {
+        text += (char)('a' + i % 26);
+    }
+    // An escaped character right where the first part ends goes to the
+    // second one.
+    text[152] = '[';
+    CHECK_EQ(modem.sendSMS("+4912345", text.c_str()), A6_OK);
+    CHECK_EQ(sim.sent.size(), 2UL);
+    CHECK_EQ(sim.sent[0].header, "151");
+    CHECK_EQ(sim.sent[1].header, "60");
+    CHECK_EQ(sim.sent[1].payload, "0041000791942143F5000038050003000202363C7C5E1F168FC965F3199D56AFD96DF71B1E97CFE975FB1D9FD787C56372D97C46A7D56B76DBFD86C7E5");
+}
+
+
+TEST(unicodeSmsIsSentAsUCS2) {
+    A6sim sim;
+    A6lib modem(sim);
+
+    CHECK_EQ(modem.sendSMS(String("+4912345"), String("Привет 😀 €")), A6_OK);
+    CHECK_EQ(sim.sent.size(), 1UL);
+    CHECK_EQ(sim.sent[0].payload, "0001000791942143F5000816041F044004380432043504420020D83DDE00002020AC");
+}
+
+
+static std::string smsResults;
+
+static void A6testSent(byte result, int reference, void *context) {
+    smsResults += std::string((const char *)context) + "=" + std::to_string(result) + "/" + std::to_string(reference) + " ";
+}
+
+
+TEST(queuedSmsIsRetriedWithoutBlockingOtherCommands) {
+    A6sim sim;
+    A6lib modem(sim);
+    std::string modes;
+
+    smsResults.clear();
+    sim.onCommand = [&sim, &modes](const std::string &command, std::string &reply) {
+        (void)reply;
+        if (command == "+CCLK?") {
+            modes += sim.pduMode ? "pdu " : "text ";
+        }
+        return false;
+    };
+    sim.smsFailures = 1;
+    CHECK_EQ(modem.queueSMS("+30123", "one", A6testSent, (void *)"one"), A6_OK);
+    CHECK_EQ(modem.queueSMS("+30123", "two", A6testSent, (void *)"two"), A6_OK);
+    CHECK_EQ(modem.getQueuedSMSCount(), 2);
+
+    unsigned long start = millis();
+    while ((modem.getQueuedSMSCount() > 0 || modem.busy()) && millis() - start < 60000) {
+        modem.poll();
+        if (!modem.busy()) {
+            modem.submit("AT+CCLK?", "OK", "yy", 2000, 1, NULL, NULL);
+        }
+    }
+
+    CHECK_EQ(smsResults, "one=0/1 two=0/2 ");
+    CHECK_EQ(sim.sent.size(), 2UL);
+    // The other commands were never sent in PDU mode.
+    CHECK(modes.find("pdu") == std::string::npos);
+    CHECK(!sim.pduMode);
+    // The retry waited for the backoff.
+    CHECK(millis() - start >= A6_SMS_BACKOFF);
+}
+
+
+TEST(smsWaitsForRoomInTheQueue) {
+    A6sim sim;
+    A6lib modem(sim);
+    std::string modes;
+
+    smsResults.clear();
+    sim.onCommand = [&sim, &modes](const std::string &command, std::string &reply) {
+        (void)reply;
+        if (command == "+CCLK?") {
+            modes += sim.pduMode ? "pdu " : "text ";
+        }
+        return false;
+    };
+    sim.setLatency(50);
+    CHECK_EQ(modem.queueSMS("+30123", "full", A6testSent, (void *)"full"), A6_OK);
+    modem.poll();
+    CHECK_EQ(A6testCommands(sim), "AT+CMGF=0");
+    // Fill the queue while the mode is being set, so the message can't follow.
+    for (int i = 0; i < A6_QUEUE_SIZE - 2; i++) {
+        CHECK_EQ(modem.submit("AT+CCLK?", "OK", "yy", 2000, 1, NULL, NULL), A6_OK);
+    }
+    CHECK_EQ(modem.submit("ATH", "OK", "yy", 2000, 1, NULL, NULL), A6_OK);
+
+    unsigned long start = millis();
+    while ((modem.getQueuedSMSCount() > 0 || modem.busy()) && millis() - start < 60000) {
+        modem.poll();
+    }
+    CHECK_EQ(smsResults, "full=0/1 ");
+    CHECK_EQ(sim.sent.size(), 1UL);
+    CHECK_EQ(modes, "text text text ");
+    CHECK(!sim.pduMode);
+}
+
+
+TEST(smsGivesUpAfterAttempts) {
+    A6sim sim;
+    A6lib modem(sim);
+
+    smsResults.clear();
+    sim.smsFailures = A6_SMS_ATTEMPTS;
+    modem.queueSMS("+30123", "lost", A6testSent, (void *)"lost");
+    unsigned long start = millis();
+    while ((modem.getQueuedSMSCount() > 0 || modem.busy()) && millis() - start < 60000) {
+        modem.poll();
+    }
+    CHECK_EQ(smsResults, "lost=5/-1 ");
+    CHECK(!sim.pduMode);
+}
+
+
+static void A6testFillStore(A6sim &sim, int count) {
+    for (int i = 1; i <= count; i++) {
+        A6simSMS sms = { i % 2 ? "REC READ" : "REC UNREAD", "+3069" + std::to_string(i), "17/01/01,10:00:00+08", "Body number " + std::to_string(i) };
+        sim.store[i] = sms;
+    }
+}
+
+
+TEST(smsEndsWithItsReply) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord record;
+    char time[A6_DATE_SIZE];
+
+    // At 9600 baud, the OK after +CMGS takes a while to come in, and it
+    // belongs to the part, not to the next command.
+    sim.begin(9600);
+    A6testFillStore(sim, 1);
+    CHECK_EQ(modem.sendSMS("46708251358", std::string(200, 'x').c_str()), A6_OK);
+    CHECK_EQ(sim.sent.size(), 2UL);
+    CHECK_EQ(modem.readSMS(1, &record), A6_OK);
+    CHECK_EQ(record.number, "+30691");
+    CHECK_EQ(record.message, "Body number 1");
+    CHECK_EQ(modem.getRealTimeClock(time, sizeof(time)), A6_OK);
+    CHECK_EQ(time, "17/01/01,10:00:00+08");
+    CHECK_EQ(A6testCommands(sim), "AT+CMGF=0|AT+CMGS=153|AT+CMGS=61|AT+CMGF=1|AT+CMGR=1|AT+CCLK?");
+}
+
+
+TEST(smsListIsParsedInOnePass) {
+    A6sim sim;
+    A6lib modem(sim);
+    static SMSrecord records[60];
+    int locs[10];
+
+    A6testFillStore(sim, 50);
+    CHECK_EQ(modem.readSMSList(records, 60, "ALL"), 50);
+    CHECK_EQ(records[49].index, 50);
+    CHECK_EQ(records[49].status, "REC UNREAD");
+    CHECK_EQ(records[49].number, "+306950");
+    CHECK_EQ(records[49].date, "17/01/01,10:00:00+08");
+    CHECK_EQ(records[49].message, "Body number 50");
+
+    CHECK_EQ(modem.getSMSLocs(locs, 10), 10);
+    CHECK_EQ(locs[0], 1);
+    CHECK_EQ(locs[9], 10);
+    CHECK_EQ(modem.getUnreadSMSLocs(locs, 10), 0);
+}
+
+
+TEST(cutShortListingIsNotRepeated) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord records[10];
+    int listings = 0;
+
+    // A repeated listing would run into what is left of the first one, so
+    // what came in is kept.
+    A6testFillStore(sim, 3);
+    sim.onCommand = [&listings](const std::string &command, std::string &reply) {
+        if (command.compare(0, 5, "+CMGL") != 0 || listings++ > 0) {
+            return false;
+        }
+        reply = "\r\n+CMGL: 5,\"REC READ\",\"+30691\",,\"17/01/01,10:00:00+08\"\r\nBody number 1\r\n"
+                "+CMGL: 6,\"REC READ\",\"+30692\",,\"17/01/01,10:00:00+08\"\r\nBody number 2\r\n";
+        return true;
+    };
+    CHECK_EQ(modem.readSMSList(records, 10, "ALL"), 2);
+    CHECK_EQ(listings, 1);
+    CHECK_EQ(records[1].index, 6);
+
+    // Without any of it, it is.
+    sim.dropReplies(1);
+    CHECK_EQ(modem.readSMSList(records, 10, "ALL"), 3);
+    CHECK_EQ(records[2].message, "Body number 3");
+}
+
+
+TEST(longListingsDontTimeOutWhileComing) {
+    A6sim sim;
+    A6lib modem(sim);
+    int locs[50];
+
+    // The reply time learned from empty listings is far too short for a
+    // long one at 9600 baud, but it keeps coming.
+    sim.begin(9600);
+    for (int i = 0; i < 5; i++) {
+        CHECK_EQ(modem.getSMSLocs(locs, 50), 0);
+    }
+    for (int i = 1; i <= 40; i++) {
+        A6simSMS sms = { "REC READ", "+3069" + std::to_string(i), "17/01/01,10:00:00+08", std::string(160, 'x') };
+        sim.store[i] = sms;
+    }
+    size_t first = sim.commands.size();
+    CHECK_EQ(modem.getSMSLocs(locs, 50), 40);
+    CHECK_EQ(locs[39], 40);
+    CHECK_EQ(A6testCommands(sim, first), "AT+CMGL=\"ALL\"");
+}
+
+
+TEST(smsIsReadAndDeleted) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord record;
+
+    A6testFillStore(sim, 3);
+    CHECK_EQ(modem.readSMS(2, &record), A6_OK);
+    CHECK_EQ(record.index, 2);
+    CHECK_EQ(record.message, "Body number 2");
+    CHECK_EQ(sim.store[2].status, "REC READ");
+
+    SMSmessage message = modem.readSMS(3);
+    CHECK_EQ(message.number, "+30693");
+    CHECK_EQ(message.date, "17/01/01,10:00:00+08");
+    CHECK_EQ(message.message, "Body number 3");
+
+    CHECK_EQ(modem.readSMS(9, &record), A6_NOTOK);
+    CHECK_EQ(modem.deleteSMS(2), A6_OK);
+    CHECK_EQ(sim.store.count(2), 0UL);
+    CHECK_EQ(modem.deleteSMS(0, 4), A6_OK);
+    CHECK(sim.store.empty());
+}
+
+
+TEST(ucs2MessagesAreDecoded) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord records[2];
+    const char *text = "Ένα μήνυμα με ελληνικά και 😀 emoji";
+
+    sim.charset = "UCS2";
+    sim.receiveSMS("+306912345678", text);
+    CHECK_EQ(modem.readSMSList(records, 2, "ALL"), 1);
+    // Undecoded numbers are kept as hex as far as they fit.
+    CHECK_EQ(records[0].number, "002B0033003000360039003");
+
+    modem.enableSMSDecoding(1);
+    CHECK_EQ(modem.readSMSList(records, 2, "ALL"), 1);
+    CHECK_EQ(records[0].number, "+306912345678");
+    CHECK_EQ(records[0].message, text);
+}
+
+
+TEST(wholeMessagesFitInRecords) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord record;
+    std::string text(160, 'x');
+
+    // 160 characters take 640 hex digits.
+    sim.charset = "UCS2";
+    modem.enableSMSDecoding(1);
+    int index = sim.receiveSMS("+30123", text);
+    CHECK_EQ(modem.readSMS(index, &record), A6_OK);
+    CHECK_EQ(record.message, text);
+    CHECK(!record.truncated);
+
+    // Bodies over several lines can still be too long.
+    sim.charset = "IRA";
+    index = sim.receiveSMS("+30123", text + "\n" + text + "\n" + text + "\n" + text + "\n" + text);
+    CHECK_EQ(modem.readSMS(index, &record), A6_OK);
+    CHECK_EQ(strlen(record.message), (size_t)A6_MESSAGE_SIZE - 1);
+    CHECK(record.truncated);
+}
+
+
+TEST(smsAsStringIsNotTruncated) {
+    A6sim sim;
+    A6lib modem(sim);
+    std::string line(160, 'x');
+    std::string text = line + "\n" + line + "\n" + line + "\n" + line + "\n" + line;
+
+    // Too long for an SMSrecord.
+    int index = sim.receiveSMS("+30123", text);
+    CHECK_EQ(modem.readSMS(index).message, text);
+
+    sim.charset = "UCS2";
+    modem.enableSMSDecoding(1);
+    text = "Ελληνικά " + line.substr(9);
+    index = sim.receiveSMS("+306912345678", text);
+    SMSmessage sms = modem.readSMS(index);
+    CHECK_EQ(sms.number, "+306912345678");
+    CHECK_EQ(sms.date, "17/01/01,10:00:00+08");
+    CHECK_EQ(sms.message, text);
+}
+
+
+static int smsUnsolicited;
+
+static void A6testCountURC(const char *line, void *context) {
+    (void)line;
+    (void)context;
+    smsUnsolicited++;
+}
+
+
+TEST(messageBodiesAreNotTakenForReplies) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord records[10];
+    const char *texts[] = { "RING me back", "ERROR in pump 3", "+CMTI: \"ME\",9", "+CIPRCV:0,5,hello", "OK", "", "Line\nOK\n+CMS ERROR: 500" };
+    int count = sizeof(texts) / sizeof(texts[0]);
+
+    for (int i = 0; i < count; i++) {
+        sim.receiveSMS("+30123", texts[i]);
+    }
+    // Let the +CMTI for them go by.
+    A6testPoll(modem, 10);
+    smsUnsolicited = 0;
+    modem.onUnsolicited("RING", A6testCountURC, NULL);
+    modem.onUnsolicited("+CMTI:", A6testCountURC, NULL);
+
+    CHECK_EQ(modem.readSMSList(records, 10, "ALL"), count);
+    for (int i = 0; i < count; i++) {
+        CHECK_EQ(records[i].message, texts[i]);
+        CHECK_EQ(records[i].number, "+30123");
+    }
+    for (int i = 0; i < count; i++) {
+        CHECK_EQ(modem.readSMS(i + 1, &records[0]), A6_OK);
+        CHECK_EQ(records[0].message, texts[i]);
+        CHECK_EQ(modem.readSMS(i + 1).message, texts[i]);
+    }
+    CHECK_EQ(smsUnsolicited, 0);
+
+    // Outside of a message, they still are.
+    sim.inject("\r\nRING\r\n");
+    A6testPoll(modem, 10);
+    CHECK_EQ(smsUnsolicited, 1);
+}
+
+
+TEST(bulkReadsAndDeletes) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord records[10];
+    int wanted[4] = { 3, 99, 17, 28 };
+    byte results[4];
+    int deleted[40];
+
+    for (int i = 1; i <= 30; i++) {
+        A6simSMS sms = { i > 25 ? "REC UNREAD" : "REC READ", "+30" + std::to_string(i), "17/01/01,10:00:00+08", "msg " + std::to_string(i) };
+        sim.store[i] = sms;
+    }
+
+    size_t first = sim.commands.size();
+    CHECK_EQ(modem.readSMSRange(24, 27, records, 10), 4);
+    CHECK_EQ(records[0].index, 24);
+    CHECK_EQ(records[3].message, "msg 27");
+    CHECK_EQ(modem.readSMSRange(29, 35, records, 1), 1);
+    CHECK_EQ(records[0].index, 29);
+
+    CHECK_EQ(modem.readSMS(wanted, 4, records, results), 3);
+    CHECK_EQ(results[0], A6_OK);
+    CHECK_EQ(records[0].message, "msg 3");
+    CHECK_EQ(results[1], A6_NOTOK);
+    CHECK_EQ(records[2].message, "msg 17");
+    CHECK_EQ(records[3].message, "msg 28");
+    // One listing each, which leaves the unread messages unread.
+    CHECK_EQ(A6testCommands(sim, first), "AT+CMGL=\"ALL\",1|AT+CMGL=\"ALL\",1|AT+CMGL=\"ALL\",1");
+    CHECK_EQ(sim.store[26].status, "REC UNREAD");
+
+    A6simSMS fresh = { "REC UNREAD", "+3040", "17/01/01,10:00:00+08", "new" };
+    sim.store[40] = fresh;
+    first = sim.commands.size();
+    CHECK_EQ(modem.deleteSMSOfType("REC READ", deleted, 40), 25);
+    CHECK_EQ(sim.store.size(), 6UL);
+    CHECK_EQ(modem.deleteSMSOfType("REC UNREAD", deleted, 40), 6);
+    CHECK_EQ(deleted[0], 26);
+    CHECK_EQ(deleted[5], 40);
+    CHECK(sim.store.empty());
+    CHECK_EQ(A6testCommands(sim, first), "AT+CMGL=\"REC READ\"|AT+CMGD=1,1|AT+CMGL=\"REC UNREAD\"|AT+CMGD=26|AT+CMGD=27|AT+CMGD=28|AT+CMGD=29|AT+CMGD=30|AT+CMGD=40");
+
+    // A message that arrives after the listing isn't deleted with the others.
+    sim.store[1] = fresh;
+    sim.store[2] = fresh;
+    sim.onCommand = [&sim, &fresh](const std::string &command, std::string &reply) {
+        (void)reply;
+        if (command.compare(0, 6, "+CMGD=") == 0) {
+            sim.store[3] = fresh;
+        }
+        return false;
+    };
+    CHECK_EQ(modem.deleteSMSOfType("ALL", deleted, 40), 2);
+    CHECK_EQ(sim.store.size(), 1UL);
+    CHECK_EQ(sim.store.count(3), 1UL);
+}
+
+
+TEST(bulkReadsWithoutListingModes) {
+    A6sim sim;
+    A6lib modem(sim);
+    SMSrecord records[10];
+
+    A6testFillStore(sim, 5);
+    sim.onCommand = [](const std::string &command, std::string &reply) {
+        reply = "\r\n+CMS ERROR: 302\r\n";
+        return command == "+CMGL=\"ALL\",1";
+    };
+    size_t first = sim.commands.size();
+    CHECK_EQ(modem.readSMSRange(2, 3, records, 10), 2);
+    CHECK_EQ(records[1].message, "Body number 3");
+    // It isn't asked again.
+    CHECK_EQ(modem.readSMSRange(4, 4, records, 10), 1);
+    CHECK_EQ(records[0].message, "Body number 4");
+    CHECK_EQ(A6testCommands(sim, first), "AT+CMGL=\"ALL\",1|AT+CMGR=2|AT+CMGR=3|AT+CMGR=4");
+}
+
+
+// Runs expression and checks that it didn't allocate.
+#define CHECK_NO_ALLOCATIONS(expression) \
+    do { \
+        unsigned long before = A6shimAllocations(); \
+        expression; \
+        if (A6shimAllocations() != before) { \
+            A6testFail(__FILE__, __LINE__, #expression " allocated"); \
+        } \
+    } while (0)
+
+TEST(charPointerApiDoesNotAllocate) {
+    A6sim sim;
+    A6lib modem(sim);
+    callRecord call;
+    char time[A6_DATE_SIZE];
+    SMSrecord records[2];
+    int locs[4];
+
+    A6testFillStore(sim, 2);
+    sim.setLatency(5);
+    CHECK_NO_ALLOCATIONS(modem.dial("+1234567890"));
+    CHECK_NO_ALLOCATIONS(modem.checkCallStatus(&call));
+    CHECK_NO_ALLOCATIONS(modem.getRealTimeClock(time, sizeof(time)));
+    CHECK_NO_ALLOCATIONS(modem.readSMSList(records, 2, "ALL"));
+    CHECK_NO_ALLOCATIONS(modem.getUnreadSMSLocs(locs, 4));
+    CHECK_NO_ALLOCATIONS(modem.readSMS(1, records));
+    CHECK_NO_ALLOCATIONS(modem.sendSMS("+30123", "hello"));
+    CHECK_NO_ALLOCATIONS(modem.deleteSMS(1, 4));
+    CHECK_NO_ALLOCATIONS(modem.setSMScharset("GSM"));
+    CHECK_NO_ALLOCATIONS(modem.getSignalStrength());
+}